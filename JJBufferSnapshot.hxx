@@ -0,0 +1,447 @@
+/**
+ * @file JJBufferSnapshot.hxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Binary snapshot of the mixing buffers, used to hand warm buffers from one job to the next
+ * @version 1.0
+ * @date 2024-12-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef JJBufferSnapshot_hxx
+    #define JJBufferSnapshot_hxx
+
+    #include <vector>
+    #include <string>
+    #include <string_view>
+    #include <memory>
+    #include <iostream>
+    #include <fstream>
+    #include <stdexcept>
+    #include <type_traits>
+    #include <utility>
+    #include <cstring>
+    #include <cstdint>
+    #include <cstddef>
+    #include "JJEventRing.hxx"
+
+    namespace Mixing
+    {
+        /**
+         * @brief Conversion of a track to and from a fixed-size binary record. Specialise this struct for your track class to enable JJFemtoMixer::SaveBuffers and JJFemtoMixer::LoadBuffers, e.g.:
+         * @code
+         * template<> struct Mixing::TrackSerializer<MyTrack>
+         * {
+         *     static constexpr std::size_t Size = 3 * sizeof(float);
+         *     static void Write(const MyTrack &track, unsigned char *dest) {std::memcpy(dest,&track.px,Size);}
+         *     static MyTrack Read(const unsigned char *src) {MyTrack track; std::memcpy(&track.px,src,Size); return track;}
+         * };
+         * @endcode
+         * For trivially copyable tracks you can simply derive from TriviallyCopyableTrackSerializer.
+         *
+         * @tparam Track track type
+         */
+        template<typename Track>
+        struct TrackSerializer;
+
+        /**
+         * @brief TrackSerializer which copies the bytes of the track object. Only for trivially copyable tracks and only for snapshots read on the same platform.
+         *
+         * @tparam Track track type
+         */
+        template<typename Track>
+        struct TriviallyCopyableTrackSerializer
+        {
+            static_assert(std::is_trivially_copyable<Track>::value,"TriviallyCopyableTrackSerializer requires a trivially copyable track type!");
+
+            static constexpr std::size_t Size = sizeof(Track);
+            static void Write(const Track &track, unsigned char *dest) {std::memcpy(dest,&track,Size);}
+            static Track Read(const unsigned char *src) {Track track; std::memcpy(&track,src,Size); return track;}
+        };
+
+        namespace Detail
+        {
+            /**
+             * @brief Check if TrackSerializer was specialised for given track type
+             *
+             */
+            template<typename Track, typename Enable = void>
+            struct HasTrackSerializer : std::false_type {};
+
+            template<typename Track>
+            struct HasTrackSerializer<Track, std::void_t<decltype(TrackSerializer<Track>::Size),
+                                                         decltype(TrackSerializer<Track>::Write(std::declval<const Track&>(),std::declval<unsigned char*>())),
+                                                         decltype(TrackSerializer<Track>::Read(std::declval<const unsigned char*>()))> > : std::true_type {};
+
+            // kind of the event keys of a snapshot, stored in the header
+            inline constexpr std::uint32_t SnapshotKeyString = 1;
+            inline constexpr std::uint32_t SnapshotKeyIntegral = 2; // integers and enums
+            inline constexpr std::uint32_t SnapshotKeyTrivial = 3; // any other trivially copyable type
+
+            /**
+             * @brief Conversion of an event key to and from bytes. Strings are stored as they are, other keys have to be trivially copyable.
+             * Kind and Size describe the key type in the snapshot header, Size is 0 for strings, which may have any length.
+             *
+             * @tparam Key event key type
+             */
+            template<typename Key>
+            struct KeyCodec
+            {
+                static_assert(std::is_trivially_copyable<Key>::value,"Event keys stored in a snapshot have to be std::string or a trivially copyable type!");
+
+                static constexpr std::uint32_t Kind = (std::is_integral<Key>::value || std::is_enum<Key>::value) ? SnapshotKeyIntegral : SnapshotKeyTrivial;
+                static constexpr std::uint32_t Size = sizeof(Key);
+
+                [[nodiscard]] static std::string Encode(const Key &key) {return std::string(reinterpret_cast<const char*>(&key),sizeof(Key));}
+                [[nodiscard]] static Key Decode(std::string_view bytes)
+                {
+                    if (bytes.size() != sizeof(Key))
+                        throw std::runtime_error("JJBufferSnapshot: event key size does not match the key type of the mixer");
+
+                    Key key;
+                    std::memcpy(&key,bytes.data(),sizeof(Key));
+                    return key;
+                }
+            };
+
+            template<>
+            struct KeyCodec<std::string>
+            {
+                static constexpr std::uint32_t Kind = SnapshotKeyString;
+                static constexpr std::uint32_t Size = 0;
+
+                [[nodiscard]] static std::string Encode(const std::string &key) {return key;}
+                [[nodiscard]] static std::string Decode(std::string_view bytes) {return std::string(bytes);}
+            };
+
+            struct SnapshotHeader
+            {
+                char magic[8];
+                std::uint32_t version;
+                std::uint32_t byteOrder;
+                std::uint32_t keyKind;
+                std::uint32_t keySize;
+                std::uint64_t trackSize;
+                std::uint64_t trackStride;
+                std::uint64_t bufferSize;
+                std::uint64_t nClasses;
+                std::uint64_t nEntries;
+                std::uint64_t tracksOffset;
+                std::uint64_t stringsOffset;
+                std::uint64_t fileSize;
+            };
+
+            struct SnapshotClassRecord
+            {
+                std::uint64_t keyOffset;
+                std::uint64_t keySize;
+                std::uint64_t firstEntry;
+                std::uint64_t nEntries;
+                std::uint64_t popCounter;
+            };
+
+            struct SnapshotEntryRecord
+            {
+                std::uint64_t eventId;
+                std::uint64_t firstTrack;
+                std::uint64_t nTracks;
+            };
+
+            inline constexpr char SnapshotMagic[8] = {'J','J','M','I','X','B','U','F'};
+            inline constexpr std::uint32_t SnapshotVersion = 1;
+            inline constexpr std::uint32_t SnapshotByteOrder = 0x01020304;
+
+            [[nodiscard]] constexpr std::uint64_t AlignSnapshotOffset(std::uint64_t offset) noexcept {return (offset + 7) & ~std::uint64_t(7);}
+        }
+
+        /**
+         * @brief Builds a snapshot of the mixing buffers and writes it to a stream.
+         *
+         * The file consists of (all integers are 64-bit in the byte order of the writing machine, all sections start at a multiple of 8 bytes):
+         * - a header: magic "JJMIXBUF", version, byte order mark, kind and size of the event keys, track record size and stride, buffer size, number of event classes and entries, offsets of the track and string sections, total size
+         * - the class table: key (offset and size in the string section), first entry, number of entries and the number of popped events for each event class
+         * - the entry table: integer event ID, first track and number of tracks of each buffered event
+         * - the track section: one TrackSerializer record of trackStride bytes per buffered track
+         * - the string section: the event keys
+         *
+         * Fixed-size tables make the file memory-mappable: JJBufferSnapshotView can read it in place without parsing it first.
+         *
+         * @tparam Track track type with a TrackSerializer specialisation
+         * @tparam Key event key type (see Detail::KeyCodec)
+         */
+        template<typename Track, typename Key>
+        class JJBufferSnapshotWriter
+        {
+            static_assert(Detail::HasTrackSerializer<Track>::value,"Mixing::TrackSerializer has to be specialised for the track type to save the mixing buffers!");
+
+            private:
+                static constexpr std::uint64_t TrackStride = Detail::AlignSnapshotOffset((TrackSerializer<Track>::Size > 0) ? TrackSerializer<Track>::Size : 1);
+
+                std::uint64_t m_bufferSize;
+                std::vector<Detail::SnapshotClassRecord> m_classes;
+                std::vector<Detail::SnapshotEntryRecord> m_entries;
+                std::vector<unsigned char> m_tracks;
+                std::string m_strings;
+
+            public:
+                /**
+                 * @brief Construct a new writer
+                 *
+                 * @param bufferSize buffer size of the mixer (stored for information)
+                 */
+                explicit JJBufferSnapshotWriter(std::size_t bufferSize) : m_bufferSize(bufferSize) {}
+                /**
+                 * @brief Add the buffer of a single event class.
+                 *
+                 * @param key event key
+                 * @param popCounter number of events popped from the buffer so far
+                 * @param buffer buffered events
+                 */
+                void AddClass(const Key &key, std::uint64_t popCounter, const JJEventRing<Track> &buffer)
+                {
+                    const std::string keyBytes = Detail::KeyCodec<Key>::Encode(key);
+                    m_classes.push_back(Detail::SnapshotClassRecord{m_strings.size(),keyBytes.size(),m_entries.size(),buffer.size(),popCounter});
+                    m_strings += keyBytes;
+
+                    for (std::size_t entry = 0; entry < buffer.size(); ++entry)
+                    {
+                        const auto &tracks = *buffer[entry].tracks;
+                        m_entries.push_back(Detail::SnapshotEntryRecord{buffer[entry].eventId,m_tracks.size() / TrackStride,tracks.size()});
+
+                        for (const auto &track : tracks)
+                        {
+                            const std::size_t position = m_tracks.size();
+                            m_tracks.resize(position + TrackStride,0);
+                            TrackSerializer<Track>::Write(track,m_tracks.data() + position);
+                        }
+                    }
+                }
+                /**
+                 * @brief Write the snapshot to given stream.
+                 *
+                 * @param stream output stream (opened in binary mode)
+                 * @throws std::runtime_error if writing failed
+                 */
+                void Write(std::ostream &stream) const
+                {
+                    Detail::SnapshotHeader header{};
+                    std::memcpy(header.magic,Detail::SnapshotMagic,sizeof(header.magic));
+                    header.version = Detail::SnapshotVersion;
+                    header.byteOrder = Detail::SnapshotByteOrder;
+                    header.keyKind = Detail::KeyCodec<Key>::Kind;
+                    header.keySize = Detail::KeyCodec<Key>::Size;
+                    header.trackSize = TrackSerializer<Track>::Size;
+                    header.trackStride = TrackStride;
+                    header.bufferSize = m_bufferSize;
+                    header.nClasses = m_classes.size();
+                    header.nEntries = m_entries.size();
+                    header.tracksOffset = sizeof(Detail::SnapshotHeader) + m_classes.size() * sizeof(Detail::SnapshotClassRecord) + m_entries.size() * sizeof(Detail::SnapshotEntryRecord);
+                    header.stringsOffset = header.tracksOffset + m_tracks.size();
+                    header.fileSize = header.stringsOffset + m_strings.size();
+
+                    stream.write(reinterpret_cast<const char*>(&header),sizeof(header));
+                    stream.write(reinterpret_cast<const char*>(m_classes.data()),m_classes.size() * sizeof(Detail::SnapshotClassRecord));
+                    stream.write(reinterpret_cast<const char*>(m_entries.data()),m_entries.size() * sizeof(Detail::SnapshotEntryRecord));
+                    stream.write(reinterpret_cast<const char*>(m_tracks.data()),m_tracks.size());
+                    stream.write(m_strings.data(),m_strings.size());
+
+                    if (! stream)
+                        throw std::runtime_error("JJBufferSnapshot: failed to write the snapshot");
+                }
+        };
+
+        /**
+         * @brief Read-only view of a snapshot written by JJBufferSnapshotWriter. The view does not copy the data, so it can be used directly on a memory-mapped file (which has to outlive the view).
+         * The layout is validated on construction.
+         *
+         */
+        class JJBufferSnapshotView
+        {
+            private:
+                const unsigned char *m_data;
+                std::size_t m_size;
+                Detail::SnapshotHeader m_header;
+                std::uint64_t m_nTracks;
+
+                template<typename Record>
+                [[nodiscard]] Record LoadRecord(std::uint64_t offset) const noexcept
+                {
+                    // records are copied out, so the data does not need to be aligned
+                    Record record;
+                    std::memcpy(&record,m_data + offset,sizeof(Record));
+                    return record;
+                }
+                [[nodiscard]] std::string_view GetString(std::uint64_t offset, std::uint64_t size) const
+                {
+                    if (offset > m_size - m_header.stringsOffset || size > m_size - m_header.stringsOffset - offset)
+                        throw std::runtime_error("JJBufferSnapshot: string out of range");
+
+                    return std::string_view(reinterpret_cast<const char*>(m_data + m_header.stringsOffset + offset),size);
+                }
+                [[nodiscard]] Detail::SnapshotClassRecord GetClass(std::size_t evtClass) const noexcept {return LoadRecord<Detail::SnapshotClassRecord>(sizeof(Detail::SnapshotHeader) + evtClass * sizeof(Detail::SnapshotClassRecord));}
+                [[nodiscard]] std::uint64_t GetEntryOffset(std::uint64_t entry) const noexcept {return sizeof(Detail::SnapshotHeader) + m_header.nClasses * sizeof(Detail::SnapshotClassRecord) + entry * sizeof(Detail::SnapshotEntryRecord);}
+                [[nodiscard]] Detail::SnapshotEntryRecord GetEntry(std::size_t evtClass, std::size_t entry) const noexcept {return LoadRecord<Detail::SnapshotEntryRecord>(GetEntryOffset(GetClass(evtClass).firstEntry + entry));}
+
+            public:
+                /**
+                 * @brief Construct a view of a snapshot stored in memory
+                 *
+                 * @param data beginning of the snapshot
+                 * @param size size of the snapshot in bytes
+                 * @throws std::runtime_error if the data is not a valid snapshot of a supported version
+                 */
+                JJBufferSnapshotView(const void *data, std::size_t size) : m_data(static_cast<const unsigned char*>(data)), m_size(size), m_header{}, m_nTracks(0)
+                {
+                    if (m_size < sizeof(Detail::SnapshotHeader))
+                        throw std::runtime_error("JJBufferSnapshot: data too short for a snapshot");
+
+                    m_header = LoadRecord<Detail::SnapshotHeader>(0);
+                    if (std::memcmp(m_header.magic,Detail::SnapshotMagic,sizeof(m_header.magic)) != 0)
+                        throw std::runtime_error("JJBufferSnapshot: not a mixing buffer snapshot");
+                    if (m_header.version != Detail::SnapshotVersion)
+                        throw std::runtime_error("JJBufferSnapshot: unsupported snapshot version " + std::to_string(m_header.version));
+                    if (m_header.byteOrder != Detail::SnapshotByteOrder)
+                        throw std::runtime_error("JJBufferSnapshot: snapshot written on a machine with different byte order");
+                    if (m_header.fileSize != m_size)
+                        throw std::runtime_error("JJBufferSnapshot: snapshot is truncated or has trailing data");
+                    if ((m_header.keyKind == Detail::SnapshotKeyString) != (m_header.keySize == 0)
+                        || (m_header.keyKind != Detail::SnapshotKeyString && m_header.keyKind != Detail::SnapshotKeyIntegral && m_header.keyKind != Detail::SnapshotKeyTrivial))
+                        throw std::runtime_error("JJBufferSnapshot: corrupted event key type");
+
+                    // the counts are bounded by the size first, so that the products below cannot overflow
+                    if (m_header.nClasses > m_size || m_header.nEntries > m_size || m_header.trackStride > m_size || m_header.trackStride < m_header.trackSize
+                        || m_header.stringsOffset > m_size || m_header.tracksOffset > m_header.stringsOffset)
+                        throw std::runtime_error("JJBufferSnapshot: corrupted snapshot layout");
+
+                    const std::uint64_t tracksSize = m_header.stringsOffset - m_header.tracksOffset;
+                    if (GetEntryOffset(m_header.nEntries) != m_header.tracksOffset || m_header.trackStride == 0 || tracksSize % m_header.trackStride != 0)
+                        throw std::runtime_error("JJBufferSnapshot: corrupted snapshot layout");
+
+                    m_nTracks = tracksSize / m_header.trackStride;
+
+                    for (std::size_t evtClass = 0; evtClass < m_header.nClasses; ++evtClass)
+                    {
+                        const Detail::SnapshotClassRecord record = GetClass(evtClass);
+                        if (record.firstEntry > m_header.nEntries || record.nEntries > m_header.nEntries - record.firstEntry
+                            || (m_header.keySize != 0 && record.keySize != m_header.keySize))
+                            throw std::runtime_error("JJBufferSnapshot: corrupted class table");
+
+                        for (std::size_t entry = 0; entry < record.nEntries; ++entry)
+                        {
+                            const Detail::SnapshotEntryRecord entryRecord = GetEntry(evtClass,entry);
+                            if (entryRecord.firstTrack > m_nTracks || entryRecord.nTracks > m_nTracks - entryRecord.firstTrack)
+                                throw std::runtime_error("JJBufferSnapshot: corrupted entry table");
+                        }
+                    }
+                }
+                /**
+                 * @brief Get the snapshot format version.
+                 *
+                 * @return std::uint32_t
+                 */
+                [[nodiscard]] std::uint32_t GetVersion() const noexcept {return m_header.version;}
+                /**
+                 * @brief Check that the event keys of the snapshot can be read as given key type, i.e. that both the kind (string, integral or other) and the size of the keys match.
+                 *
+                 * @tparam Key event key type of the reading mixer
+                 * @throws std::runtime_error if the snapshot was written by a mixer with a different key type
+                 */
+                template<typename Key>
+                void CheckKeyType() const
+                {
+                    if (m_header.keyKind != Detail::KeyCodec<Key>::Kind || m_header.keySize != Detail::KeyCodec<Key>::Size)
+                        throw std::runtime_error("JJBufferSnapshot: event key type of the snapshot does not match the key type of the mixer");
+                }
+                /**
+                 * @brief Get the size of a single track record (TrackSerializer::Size of the writer).
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetTrackSize() const noexcept {return m_header.trackSize;}
+                /**
+                 * @brief Get the buffer size of the mixer which wrote the snapshot.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetBufferSize() const noexcept {return m_header.bufferSize;}
+                /**
+                 * @brief Get the number of event classes.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetNClasses() const noexcept {return m_header.nClasses;}
+                /**
+                 * @brief Get the encoded event key of given class.
+                 *
+                 * @param evtClass class index
+                 * @return std::string_view
+                 */
+                [[nodiscard]] std::string_view GetClassKey(std::size_t evtClass) const {const auto record = GetClass(evtClass); return GetString(record.keyOffset,record.keySize);}
+                /**
+                 * @brief Get the number of events popped from the buffer of given class.
+                 *
+                 * @param evtClass class index
+                 * @return std::uint64_t
+                 */
+                [[nodiscard]] std::uint64_t GetPopCounter(std::size_t evtClass) const noexcept {return GetClass(evtClass).popCounter;}
+                /**
+                 * @brief Get the number of buffered tracks of given class.
+                 *
+                 * @param evtClass class index
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetNEntries(std::size_t evtClass) const noexcept {return GetClass(evtClass).nEntries;}
+                /**
+                 * @brief Get the integer ID of a buffered event (see Detail::EventIdOf).
+                 *
+                 * @param evtClass class index
+                 * @param entry entry index within the class, 0 is the oldest
+                 * @return std::uint64_t
+                 */
+                [[nodiscard]] std::uint64_t GetEventID(std::size_t evtClass, std::size_t entry) const {return GetEntry(evtClass,entry).eventId;}
+                /**
+                 * @brief Get the number of tracks stored for a buffered event.
+                 *
+                 * @param evtClass class index
+                 * @param entry entry index within the class, 0 is the oldest
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetNTracks(std::size_t evtClass, std::size_t entry) const {return GetEntry(evtClass,entry).nTracks;}
+                /**
+                 * @brief Get the serialised record of a buffered track.
+                 *
+                 * @param evtClass class index
+                 * @param entry entry index within the class, 0 is the oldest
+                 * @param track track index within the event
+                 * @return const unsigned char* GetTrackSize() bytes to be passed to TrackSerializer::Read
+                 */
+                [[nodiscard]] const unsigned char* GetTrackData(std::size_t evtClass, std::size_t entry, std::size_t track) const {return m_data + m_header.tracksOffset + (GetEntry(evtClass,entry).firstTrack + track) * m_header.trackStride;}
+        };
+
+        namespace Detail
+        {
+            /**
+             * @brief Read a whole snapshot file into memory
+             *
+             * @param fileName path to the file
+             * @return std::vector<unsigned char>
+             */
+            inline std::vector<unsigned char> ReadSnapshotFile(const std::string &fileName)
+            {
+                std::ifstream file(fileName,std::ios::binary | std::ios::ate);
+                if (! file)
+                    throw std::runtime_error("JJBufferSnapshot: cannot open " + fileName);
+
+                std::vector<unsigned char> data(static_cast<std::size_t>(file.tellg()));
+                file.seekg(0);
+                file.read(reinterpret_cast<char*>(data.data()),data.size());
+                if (! file)
+                    throw std::runtime_error("JJBufferSnapshot: cannot read " + fileName);
+
+                return data;
+            }
+        }
+    }
+
+#endif
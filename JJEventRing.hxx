@@ -0,0 +1,210 @@
+/**
+ * @file JJEventRing.hxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Fixed-capacity ring buffer of events used as the mixing buffer of a single event class
+ * @version 1.0
+ * @date 2024-12-21
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef JJEventRing_hxx
+    #define JJEventRing_hxx
+
+    #include <vector>
+    #include <string>
+    #include <memory>
+    #include <functional>
+    #include <type_traits>
+    #include <utility>
+    #include <cstdint>
+    #include <cstddef>
+
+    namespace Mixing
+    {
+        namespace Detail
+        {
+            /**
+             * @brief Integer ID of an event. Integral IDs returned by Event::GetID() are used directly, std::string IDs are hashed.
+             *
+             * @tparam Event event type
+             * @param event event object
+             * @return std::uint64_t
+             */
+            template<typename Event>
+            [[nodiscard]] std::uint64_t EventIdOf(const Event &event)
+            {
+                using IdType = std::decay_t<decltype(event.GetID())>;
+                if constexpr (std::is_integral<IdType>::value)
+                    return static_cast<std::uint64_t>(event.GetID());
+                else
+                    return static_cast<std::uint64_t>(std::hash<IdType>{}(event.GetID()));
+            }
+        }
+
+        /**
+         * @brief Fixed-capacity ring buffer holding the last events of an event class: an integer event ID and a few tracks stored by value for each event.
+         * The storage of a slot is reused when the slot is overwritten, unless pointers to its tracks are still held outside of the ring (e.g. by pairs kept by the user), in which case the slot gets new storage.
+         * The reuse relies on std::shared_ptr::use_count(), which does not synchronise with the threads releasing the pointers, so a ring whose tracks are read by other threads has to be created without the reuse.
+         *
+         * @tparam Track track type (copy-constructible)
+         */
+        template<typename Track>
+        class JJEventRing
+        {
+            public:
+                using TrackBlock = std::vector<Track>;
+
+                /**
+                 * @brief Single buffered event
+                 *
+                 */
+                struct Entry
+                {
+                    std::uint64_t eventId = 0;
+                    std::shared_ptr<TrackBlock> tracks;
+                };
+
+            private:
+                std::vector<Entry> m_slots;
+                std::size_t m_capacity, m_head, m_size;
+                bool m_reuseStorage;
+
+                [[nodiscard]] std::size_t SlotIndex(std::size_t entry) const noexcept {return (m_head + entry) % m_capacity;}
+
+            public:
+                /**
+                 * @brief Construct an empty ring
+                 *
+                 * @param capacity maximal number of stored events, 0 for a ring which stores nothing
+                 * @param reuseStorage reuse the track storage of overwritten slots which are not referenced elsewhere, false to always allocate new storage
+                 */
+                explicit JJEventRing(std::size_t capacity = 1, bool reuseStorage = true) : m_capacity(capacity), m_head(0), m_size(0), m_reuseStorage(reuseStorage)
+                {
+                    m_slots.reserve(m_capacity);
+                }
+                /**
+                 * @brief Get the number of stored events.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t size() const noexcept {return m_size;}
+                /**
+                 * @brief Check if no events are stored.
+                 *
+                 * @return true
+                 * @return false
+                 */
+                [[nodiscard]] bool empty() const noexcept {return m_size == 0;}
+                /**
+                 * @brief Check if the next Push() will overwrite the oldest event (always true for a ring of capacity 0).
+                 *
+                 * @return true
+                 * @return false
+                 */
+                [[nodiscard]] bool full() const noexcept {return m_size == m_capacity;}
+                /**
+                 * @brief Get the maximal number of stored events.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t capacity() const noexcept {return m_capacity;}
+                /**
+                 * @brief Get a stored event.
+                 *
+                 * @param entry entry index, 0 is the oldest event
+                 * @return const Entry&
+                 */
+                [[nodiscard]] const Entry& operator[](std::size_t entry) const noexcept {return m_slots[SlotIndex(entry)];}
+                /**
+                 * @brief Get a shared pointer to a stored track. The pointer shares the ownership of the track storage of the event, no new object is allocated.
+                 *
+                 * @param entry entry index, 0 is the oldest event
+                 * @param track track index within the event
+                 * @return std::shared_ptr<Track>
+                 */
+                [[nodiscard]] std::shared_ptr<Track> GetTrack(std::size_t entry, std::size_t track) const
+                {
+                    const auto &block = m_slots[SlotIndex(entry)].tracks;
+                    return std::shared_ptr<Track>(block,&(*block)[track]);
+                }
+                /**
+                 * @brief Append an event, overwriting the oldest one if the ring is full. The capacity has to be at least 1.
+                 *
+                 * @param eventId integer event ID
+                 * @return TrackBlock& empty track storage of the new event, to be filled by the caller
+                 */
+                TrackBlock& Push(std::uint64_t eventId)
+                {
+                    Entry *slot = nullptr;
+                    if (m_size < m_capacity)
+                    {
+                        // the head is at 0 until the ring gets full, so the slots are created in order
+                        const std::size_t index = SlotIndex(m_size);
+                        if (index == m_slots.size())
+                            m_slots.emplace_back();
+                        slot = &m_slots[index];
+                        ++m_size;
+                    }
+                    else
+                    {
+                        slot = &m_slots[m_head];
+                        m_head = (m_head + 1) % m_capacity;
+                    }
+
+                    slot->eventId = eventId;
+                    if (! m_reuseStorage || slot->tracks == nullptr || slot->tracks.use_count() > 1)
+                        slot->tracks = std::make_shared<TrackBlock>();
+                    else
+                        slot->tracks->clear();
+
+                    return *slot->tracks;
+                }
+                /**
+                 * @brief Remove all events (the slots are kept for reuse).
+                 *
+                 */
+                void clear() noexcept
+                {
+                    m_head = 0;
+                    m_size = 0;
+                }
+                /**
+                 * @brief Change the capacity, keeping the newest events.
+                 *
+                 * @param capacity new maximal number of stored events, 0 removes all events
+                 * @return std::size_t number of removed events
+                 */
+                std::size_t SetCapacity(std::size_t capacity)
+                {
+                    const std::size_t nRemoved = (m_size > capacity) ? m_size - capacity : 0;
+
+                    std::vector<Entry> slots;
+                    slots.reserve(capacity);
+                    for (std::size_t entry = nRemoved; entry < m_size; ++entry)
+                        slots.push_back(std::move(m_slots[SlotIndex(entry)]));
+
+                    m_slots = std::move(slots);
+                    m_capacity = capacity;
+                    m_head = 0;
+                    m_size = m_slots.size();
+
+                    return nRemoved;
+                }
+                /**
+                 * @brief Estimated memory taken by a full ring, including the ring object itself.
+                 *
+                 * @param capacity number of stored events
+                 * @param tracksPerEvent number of tracks stored for each event
+                 * @return std::size_t
+                 */
+                [[nodiscard]] static constexpr std::size_t EstimateBytes(std::size_t capacity, std::size_t tracksPerEvent) noexcept
+                {
+                    // a slot is the entry, the shared vector (object and control block) and its elements
+                    return sizeof(JJEventRing) + capacity * (sizeof(Entry) + sizeof(TrackBlock) + 3 * sizeof(void*) + tracksPerEvent * sizeof(Track));
+                }
+        };
+    }
+
+#endif
@@ -21,92 +21,506 @@
     #include <memory>
     #include <iostream>
     #include <iomanip>
+    #include <limits>
+    #include <algorithm>
+    #include <cstdint>
     #include "JJUtils.hxx"
+    #include "JJFlatHashMap.hxx"
+    #include "JJPairArena.hxx"
+    #include "JJTrackSoA.hxx"
+    #include "JJMixerCounters.hxx"
+    #include "JJEventRing.hxx"
+    #include "JJBufferSnapshot.hxx"
 
     namespace Mixing
     {
-        template<typename Event, typename Track, typename Pair>
+        /**
+         * @brief Properties of the key type used for event or pair grouping. Specialise this struct for your own key type (e.g. a struct with a std::hash specialisation) and provide the Default() and Bad() functions.
+         * 
+         * @tparam Key key type
+         * @tparam Enable SFINAE helper
+         */
+        template<typename Key, typename Enable = void>
+        struct KeyTraits
+        {
+            /**
+             * @brief Key assigned to all objects when no hashing function was set.
+             * 
+             * @return Key 
+             */
+            static Key Default() {return Key{};}
+        };
+
+        /**
+         * @brief Key traits for the std::string keys (the original string-based mode).
+         * 
+         */
+        template<>
+        struct KeyTraits<std::string>
+        {
+            /**
+             * @brief Key assigned to all objects when no hashing function was set.
+             * 
+             * @return std::string "0"
+             */
+            static std::string Default() {return "0";}
+            /**
+             * @brief Key reserved for pairs which did not pass the pair cut.
+             * 
+             * @return std::string "bad"
+             */
+            static std::string Bad() {return "bad";}
+        };
+
+        /**
+         * @brief Key traits for integral keys, e.g. packed bin indices. The maximal value of the type is reserved for the pairs which did not pass the pair cut.
+         * 
+         * @tparam Key integral key type
+         */
+        template<typename Key>
+        struct KeyTraits<Key, std::enable_if_t<std::is_integral<Key>::value> >
+        {
+            /**
+             * @brief Key assigned to all objects when no hashing function was set.
+             * 
+             * @return constexpr Key 0
+             */
+            static constexpr Key Default() {return 0;}
+            /**
+             * @brief Key reserved for pairs which did not pass the pair cut.
+             * 
+             * @return constexpr Key maximal value of the type
+             */
+            static constexpr Key Bad() {return std::numeric_limits<Key>::max();}
+        };
+
+        /**
+         * @brief Container used by the mixer for anything indexed by a hash. The std::string keys keep the original std::map (so the output stays sorted and backwards compatible), any other key type uses a flat open-addressing table.
+         * 
+         * @tparam Key key type
+         * @tparam Value mapped type
+         */
+        template<typename Key, typename Value>
+        using KeyedMap = std::conditional_t<std::is_same<Key,std::string>::value, std::map<Key,Value>, JJUtils::FlatHashMap<Key,Value> >;
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        class JJFemtoMixerConcurrent;
+
+        template<typename Event, typename Track, typename Pair, typename EventHashing, typename PairHashing, typename PairCut>
+        class JJFemtoMixerStatic;
+
+        /**
+         * @brief Mixer of identical-particle pairs for the signal (same event) and background (mixed events) distributions.
+         * 
+         * @tparam Event event type
+         * @tparam Track track type
+         * @tparam Pair pair type
+         * @tparam EventKey type returned by the event hashing function, std::string by default. Use e.g. a packed std::uint32_t bin index to avoid string building and comparisons.
+         * @tparam PairKey type returned by the pair hashing function, std::string by default. KeyTraits<PairKey>::Bad() is reserved for rejected pairs.
+         */
+        template<typename Event, typename Track, typename Pair, typename EventKey = std::string, typename PairKey = std::string>
         class JJFemtoMixer
         {
             static_assert(std::is_class<Event>::value,"Provided event-type template parameter is not a class or a struct!");
             static_assert(std::is_class<Track>::value,"Provided track-type template parameter is not a class or a struct!");
             static_assert(std::is_class<Pair>::value,"Provided pair-type template parameter is not a class or a struct!");
 
+            friend class JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>;
+            template<typename, typename, typename, typename, typename, typename> friend class JJFemtoMixerStatic;
+
+            public:
+                /**
+                 * @brief Collection of sorted pairs returned by the mixer (each "branch"/bucket is a single group of similar pairs).
+                 * 
+                 */
+                using PairMap = KeyedMap<PairKey, std::vector<std::shared_ptr<Pair> > >;
+                /**
+                 * @brief Collection of sorted value-type pairs, owned by the mixer and reused between events.
+                 * 
+                 */
+                using PairArena = JJPairArena<Pair,PairKey>;
+
             private:
-                std::size_t m_bufferSize;
-                bool m_waitForBuffer,m_eventHashingFunctionIsDefined,m_pairHashingFunctionIsDefined,m_pairCutFunctionIsDefined;
-                std::map<std::string, std::deque<std::pair<std::string, std::shared_ptr<Track> > > > m_similarityMap;
-                std::map<std::string,std::size_t> m_bufferPopCounter;
-                std::function<std::string(const std::shared_ptr<Event> &)> m_eventHashingFunction;
-                std::function<std::string(const std::shared_ptr<Pair> &)> m_pairHashingFunction;
+                /**
+                 * @brief Mixed pair stored in the background pair cache together with its group
+                 * 
+                 */
+                struct CachedPair
+                {
+                    std::shared_ptr<Pair> pair;
+                    PairKey key;
+                };
+                using Buffer = JJEventRing<Track>;
+                // small engine state, since every event class has its own generator
+                using ClassRandomGenerator = std::minstd_rand;
+                // element k holds, for each partner entry j < k, the pairs of the tracks of entry k with the tracks of entry j, so popping the oldest entry removes the front of every element
+                using PairCache = std::deque<std::deque<std::vector<CachedPair> > >;
+                /**
+                 * @brief Mixing buffer of a single event class
+                 * 
+                 */
+                struct ClassBuffer
+                {
+                    Buffer ring;
+                    std::size_t popCounter;
+                    PairCache pairCache;
+                    std::size_t cacheBytes; // estimated memory taken by the cached pairs
+                    std::uint64_t lastFilled; // value of the fill clock when the class last received an event, its key in m_classesByFill
+                    ClassRandomGenerator randomGenerator;
+                };
+                /**
+                 * @brief Layout of tracks collected from several buffered events (tracks of one event are adjacent). Empty vectors describe the tracks of a single event.
+                 * partnerBegin[i] is the index of the first track which may be paired with track i (the first track of the next event), empty if each track may be paired with all following tracks.
+                 * parity[i] is the parity of the position of track i in the buffer (entry index plus track index), empty if the orientation of the pairs alternates with their index.
+                 * 
+                 */
+                struct TrackLayout
+                {
+                    std::vector<std::size_t> partnerBegin;
+                    std::vector<std::uint8_t> parity;
+                };
+                /**
+                 * @brief Buffered tracks of similar events together with their layout
+                 * 
+                 */
+                struct SimilarTracks
+                {
+                    std::vector<std::shared_ptr<Track> > tracks;
+                    TrackLayout layout;
+                };
+
+                std::size_t m_bufferSize,m_tracksPerEvent,m_memoryBudget,m_evictedClasses,m_cacheBytes;
+                std::uint64_t m_fillClock; // counts the filled events, orders the classes by their last use, every value is given to one class only (set by JJFemtoMixerConcurrent, so that the shards can be compared)
+                bool m_waitForBuffer,m_eventHashingFunctionIsDefined,m_pairHashingFunctionIsDefined,m_pairCutFunctionIsDefined,m_cacheBackgroundPairs,m_pairPreCutIsDefined;
+                JJPairPreCut m_pairPreCut;
+                bool m_countersEnabled;
+                bool m_reuseTrackStorage; // reuse the track storage of overwritten buffer entries (see JJEventRing), disabled by JJFemtoMixerConcurrent, which reads the buffered tracks outside of the shard lock
+                mutable JJMixerCounters m_counters;
+                KeyedMap<EventKey, ClassBuffer> m_similarityMap;
+                std::map<std::uint64_t, EventKey> m_classesByFill; // classes by the value of the fill clock when they last received an event, least recently filled first (plain values, so the mixer stays copyable)
+                std::function<EventKey(const std::shared_ptr<Event> &)> m_eventHashingFunction;
+                std::function<PairKey(const std::shared_ptr<Pair> &)> m_pairHashingFunction;
                 std::function<bool(const std::shared_ptr<Pair> &)> m_pairCutFunction;
+                PairArena m_signalArena, m_backgroundArena;
+                std::uint_fast32_t m_seed;
+                /**
+                 * @brief Call given function for every combination of two tracks. The order of tracks is reversed for every other pair (get rid of the bias from the track sorter).
+                 * For the tracks of a single event the orientation alternates with the index of the pair. For buffered tracks it is reversed when the parities of the two tracks differ, so a pair keeps its orientation while the buffer slides, the same as in the background pair cache.
+                 * 
+                 * @tparam Func callable with signature void(const std::shared_ptr<Track> &, const std::shared_ptr<Track> &)
+                 * @param tracks tracks vector
+                 * @param layout partners and parities of the tracks, empty for the tracks of a single event
+                 * @param func function called for each combination
+                 */
+                template<typename Func>
+                void ForEachTrackCombination(const std::vector<std::shared_ptr<Track> > &tracks, const TrackLayout &layout, Func &&func) const;
+                /**
+                 * @brief Call given function for every combination of two tracks where the first track is in given range of rows. The orientation of each pair is the same as in ForEachTrackCombination.
+                 * 
+                 * @tparam Func callable with signature void(const std::shared_ptr<Track> &, const std::shared_ptr<Track> &)
+                 * @param tracks tracks vector
+                 * @param layout partners and parities of the tracks, empty for the tracks of a single event
+                 * @param soa tracks in the structure-of-arrays layout used for the pair pre-cut, or nullptr if there is no pre-cut
+                 * @param rowBegin first row
+                 * @param rowEnd row past the last one
+                 * @param func function called for each combination
+                 */
+                template<typename Func>
+                void ForEachTrackCombinationInRows(const std::vector<std::shared_ptr<Track> > &tracks, const TrackLayout &layout, const JJTrackSoA *soa, std::size_t rowBegin, std::size_t rowEnd, Func &&func) const;
+                /**
+                 * @brief Get the number of combinations of tracks visited by ForEachTrackCombinationInRows (before the pair pre-cut).
+                 * 
+                 * @param nTracks number of tracks
+                 * @param partnerBegin index of the first partner of each track, or empty if each track may be paired with all following tracks
+                 * @param rowBegin first row
+                 * @param rowEnd row past the last one
+                 * @return std::size_t 
+                 */
+                [[nodiscard]] static std::size_t CountCombinations(std::size_t nTracks, const std::vector<std::size_t> &partnerBegin, std::size_t rowBegin, std::size_t rowEnd) noexcept;
+                /**
+                 * @brief Call given function with the index of every track j in [begin, end) for which the pair (first, j) passes the pair pre-cut
+                 * 
+                 * @tparam Func callable with signature void(std::size_t)
+                 * @param soa tracks in the structure-of-arrays layout
+                 * @param first index of the first track
+                 * @param begin index of the first partner
+                 * @param end index past the last partner
+                 * @param func function called for each accepted partner
+                 */
+                template<typename Func>
+                void ForEachPreCutPartner(const JJTrackSoA &soa, std::size_t first, std::size_t begin, std::size_t end, Func &&func) const;
+                /**
+                 * @brief Check if the pair pre-cut has to be applied
+                 * 
+                 * @return true Pre-cut was set and the track type provides TrackKinematics.
+                 * @return false Otherwise.
+                 */
+                [[nodiscard]] constexpr bool UsesPairPreCut() const noexcept {return Detail::HasTrackKinematics<Track>::value && m_pairPreCutIsDefined;}
+                /**
+                 * @brief Get the group of the pair, i.e. KeyTraits<PairKey>::Bad() if the pair is rejected by the cut or the pair hash otherwise
+                 * 
+                 * @param pair pair object
+                 * @return PairKey 
+                 */
+                [[nodiscard]] PairKey ClassifyPair(const std::shared_ptr<Pair> &pair) const
+                {
+                    const bool isCut = m_pairCutFunction(pair);
+                    if (m_countersEnabled)
+                    {
+                        ++m_counters.pairsBuilt;
+                        m_counters.pairsCut += isCut;
+                    }
+                    return (isCut) ? KeyTraits<PairKey>::Bad() : m_pairHashingFunction(pair);
+                }
+                /**
+                 * @brief Get the counter which should be incremented, if the counters are enabled
+                 * 
+                 * @param counter member of JJMixerCounters
+                 * @return std::uint64_t* pointer to the counter or nullptr if the counters are disabled
+                 */
+                [[nodiscard]] std::uint64_t* CounterTarget(std::uint64_t JJMixerCounters::*counter) const noexcept {return (m_countersEnabled) ? &(m_counters.*counter) : nullptr;}
+                /**
+                 * @brief Build the pairs from given tracks and sort them into groups, updating the counters
+                 * 
+                 * @param tracks tracks vector
+                 * @param layout partners and parities of the tracks, empty for the tracks of a single event
+                 * @return PairMap sorted pairs
+                 */
+                [[nodiscard]] PairMap MakeSortedPairs(const std::vector<std::shared_ptr<Track> > &tracks, const TrackLayout &layout = {}) const;
+                /**
+                 * @brief Build pairs by value into the arena, updating the counters
+                 * 
+                 * @param tracks tracks vector
+                 * @param arena arena which will be reset and filled
+                 * @param layout partners and parities of the tracks, empty for the tracks of a single event
+                 */
+                void FillArenaCounted(const std::vector<std::shared_ptr<Track> > &tracks, PairArena &arena, const TrackLayout &layout = {}) const;
+                /**
+                 * @brief Get the mixing buffer of an event class and mark the class as the most recently used one. A missing buffer is created.
+                 * 
+                 * @param evtHash event class
+                 * @return ClassBuffer& 
+                 */
+                ClassBuffer& GetClassBuffer(const EventKey &evtHash);
+                /**
+                 * @brief Create the random number generator of an event class, seeded from the mixer seed and the class key. The selection of tracks in a class therefore depends only on the seed and the order of events within that class.
+                 * 
+                 * @param evtHash event class
+                 * @return ClassRandomGenerator 
+                 */
+                [[nodiscard]] ClassRandomGenerator MakeClassGenerator(const EventKey &evtHash) const;
+                /**
+                 * @brief Remove the least recently used classes until the memory usage fits in the memory budget. The most recently used class is always kept.
+                 * 
+                 */
+                void EvictClasses();
+                /**
+                 * @brief Remove the least recently used class together with its cached pairs
+                 * 
+                 */
+                void EvictLeastRecentClass();
+                /**
+                 * @brief Get the least recently used class
+                 * 
+                 * @return const ClassBuffer* the class or nullptr if no class is buffered
+                 */
+                [[nodiscard]] const ClassBuffer* GetLeastRecentClass() const;
+                /**
+                 * @brief Estimated memory taken by the pairs of one element of the background pair cache
+                 * 
+                 * @param pairs cached pairs
+                 * @return std::size_t 
+                 */
+                [[nodiscard]] static std::size_t GetCachedPairsBytes(const std::vector<CachedPair> &pairs) noexcept {return pairs.capacity() * sizeof(CachedPair) + pairs.size() * Detail::SharedObjectBytes<Pair>();}
+                /**
+                 * @brief Wrap a pair which lives in an arena or on the stack for the hashing and cutting functions, which take a std::shared_ptr.
+                 * The aliasing constructor with an empty owner gives a non-owning pointer: no control block, no allocation and no reference counting, so the pointer must not outlive the pair.
+                 * 
+                 * @param pair pair object
+                 * @return std::shared_ptr<Pair> non-owning pointer to the pair
+                 */
+                [[nodiscard]] static std::shared_ptr<Pair> MakeNonOwning(Pair &pair) noexcept {return std::shared_ptr<Pair>(std::shared_ptr<Pair>(),&pair);}
+                /**
+                 * @brief Add or remove the cached pairs of a buffer entry to or from the cache memory of its class and of the mixer
+                 * 
+                 * @param classBuffer buffer of the event class
+                 * @param entryPairs pairs of the entry with its partners
+                 * @param add true when the pairs were added, false when removed
+                 */
+                void CountCachedPairs(ClassBuffer &classBuffer, const std::deque<std::vector<CachedPair> > &entryPairs, bool add) noexcept;
+                /**
+                 * @brief Estimated memory taken by the buffer of a single event class
+                 * 
+                 * @return std::size_t 
+                 */
+                [[nodiscard]] std::size_t GetClassBytes() const noexcept {return Buffer::EstimateBytes(m_bufferSize,m_tracksPerEvent) + sizeof(ClassBuffer) - sizeof(Buffer) + sizeof(EventKey) + 3 * sizeof(void*);}
+                /**
+                 * @brief Copy randomly selected tracks of the event (GetTracksPerEvent() of them, without repetition) into the track storage of a buffer entry
+                 * 
+                 * @param tracks tracks from the current event
+                 * @param stored track storage of the buffer entry
+                 * @param generator random number generator of the event class
+                 */
+                void SampleTracks(const std::vector<std::shared_ptr<Track> > &tracks, typename Buffer::TrackBlock &stored, ClassRandomGenerator &generator) const;
+                /**
+                 * @brief Store randomly selected tracks from the event in the mixing buffer of its event class
+                 * 
+                 * @param event current event
+                 * @param tracks tracks from the current event
+                 */
+                void StoreEvent(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks);
+                /**
+                 * @brief Collect the buffered tracks which come from events similar to, but not the same as, the given event
+                 * 
+                 * @param event current event
+                 * @return SimilarTracks tracks from similar events (empty if the buffer is not full and the buffer size is fixed, or if the class is not buffered)
+                 */
+                [[nodiscard]] SimilarTracks GetSimilarTracks(const std::shared_ptr<Event> &event) const;
+                /**
+                 * @brief Check if the buffer can be used for mixing, i.e. it is full or the buffer size is not fixed
+                 * 
+                 * @param buffer mixing buffer of an event class
+                 * @return true Buffer can be used.
+                 * @return false Buffer has to be filled first.
+                 */
+                [[nodiscard]] bool IsBufferReady(const Buffer &buffer) const noexcept {return buffer.size() == m_bufferSize || m_waitForBuffer == false;}
+                /**
+                 * @brief Build and classify the pairs of given buffer entry with all of the older entries
+                 * 
+                 * @param buffer mixing buffer of an event class
+                 * @param entry index of the entry in the buffer
+                 * @return std::deque<std::vector<CachedPair> > pairs with entries 0..entry-1
+                 */
+                [[nodiscard]] std::deque<std::vector<CachedPair> > MakeCachedPairs(const Buffer &buffer, std::size_t entry) const;
+                /**
+                 * @brief Rebuild the background pair cache of all event classes from the current content of the buffers
+                 * 
+                 */
+                void RebuildPairCache();
+                /**
+                 * @brief Remove all event classes with their buffered tracks, pop counters and cached pairs
+                 * 
+                 */
+                void ClearBuffers() noexcept;
+                /**
+                 * @brief Add the buffers of all event classes to a snapshot
+                 * 
+                 * @param writer snapshot writer
+                 */
+                void AddBuffersToSnapshot(JJBufferSnapshotWriter<Track,EventKey> &writer) const;
+                /**
+                 * @brief Fill the buffer of an event class from a snapshot, keeping at most m_bufferSize newest events and m_tracksPerEvent tracks of each. The pair cache is not updated.
+                 * 
+                 * @param snapshot snapshot view
+                 * @param evtClass index of the class in the snapshot
+                 * @param evtHash decoded key of the class
+                 */
+                void LoadBufferClass(const JJBufferSnapshotView &snapshot, std::size_t evtClass, const EventKey &evtHash);
+                /**
+                 * @brief Call given function for each cached pair of the event class which does not involve the given event
+                 * 
+                 * @tparam Func callable with signature void(const CachedPair &)
+                 * @param event current event
+                 * @param func function called for each pair
+                 */
+                template<typename Func>
+                void ForEachCachedPair(const std::shared_ptr<Event> &event, Func &&func) const;
+                /**
+                 * @brief Build pairs by value from given tracks into the arena and sort them into groups
+                 * 
+                 * @param tracks tracks vector
+                 * @param arena arena which will be reset and filled
+                 * @param layout partners and parities of the tracks, empty for the tracks of a single event
+                 */
+                void FillArena(const std::vector<std::shared_ptr<Track> > &tracks, PairArena &arena, const TrackLayout &layout = {}) const;
+                /**
+                 * @brief Build each pair from given tracks on the stack, classify it and pass it straight to the visitor
+                 * 
+                 * @tparam Visitor callable with signature void(const PairKey &, const Pair &)
+                 * @param tracks tracks vector
+                 * @param visitor function called for each pair
+                 * @param layout partners and parities of the tracks, empty for the tracks of a single event
+                 */
+                template<typename Visitor>
+                void VisitPairs(const std::vector<std::shared_ptr<Track> > &tracks, Visitor &&visitor, const TrackLayout &layout = {}) const;
                 /**
                  * @brief Create pairs of identical particles from given tracks
                  * 
                  * @param tracks tracks vector
+                 * @param layout partners and parities of the tracks, empty for the tracks of a single event
                  * @return std::vector<Pair> vector of pairs
                  */
-                [[nodiscard]] std::vector<std::shared_ptr<Pair> > MakePairs(const std::vector<std::shared_ptr<Track> > &tracks) const noexcept;
+                [[nodiscard]] std::vector<std::shared_ptr<Pair> > MakePairs(const std::vector<std::shared_ptr<Track> > &tracks, const TrackLayout &layout = {}) const noexcept;
                 /**
                  * @brief Divide pairs into corresponding category (given by the pair hash)
                  * 
                  * @param pairs pairs vector
-                 * @return std::map<std::string, std::vector<Pair> > map of sorted vectors (each "branch"/bucket is a single group of similar pairs)
+                 * @return PairMap map of sorted vectors (each "branch"/bucket is a single group of similar pairs)
                  */
-                [[nodiscard]] std::map<std::string, std::vector<std::shared_ptr<Pair> > > SortPairs(const std::vector<std::shared_ptr<Pair> > &pairs) const noexcept;
+                [[nodiscard]] PairMap SortPairs(const std::vector<std::shared_ptr<Pair> > &pairs) const noexcept;
                 
             public:
                 /**
-                 * @brief Default constructor. Create mixer object with: buffer size 10, don't wait for full buffer, no hashing in event, track or pair, and no pair cut
+                 * @brief Default constructor. Create mixer object with: buffer size 10, one track per buffered event, no memory budget, don't wait for full buffer, no hashing in event, track or pair, and no pair cut
                  * 
                  */
                 constexpr JJFemtoMixer() : m_bufferSize(10), 
+                                m_tracksPerEvent(1),
+                                m_memoryBudget(0),
+                                m_evictedClasses(0),
+                                m_cacheBytes(0),
+                                m_fillClock(0),
                                 m_waitForBuffer(false), 
                                 m_eventHashingFunctionIsDefined(false),
                                 m_pairHashingFunctionIsDefined(false),
                                 m_pairCutFunctionIsDefined(false),
-                                m_eventHashingFunction([](const std::shared_ptr<Event> &){return "0";}),
-                                m_pairHashingFunction([](const std::shared_ptr<Pair> &){return "0";}),
-                                m_pairCutFunction([](const std::shared_ptr<Pair> &){return false;}) {}
+                                m_cacheBackgroundPairs(false),
+                                m_pairPreCutIsDefined(false),
+                                m_countersEnabled(false),
+                                m_reuseTrackStorage(true),
+                                m_eventHashingFunction([](const std::shared_ptr<Event> &){return KeyTraits<EventKey>::Default();}),
+                                m_pairHashingFunction([](const std::shared_ptr<Pair> &){return KeyTraits<PairKey>::Default();}),
+                                m_pairCutFunction([](const std::shared_ptr<Pair> &){return false;}),
+                                m_seed(std::random_device{}()) {}
 
                 /**
                  * @brief Set the Event Hashing Function object.
                  * 
                  * @param func Function object, can be lambda, standard function or std::function object.
                  */
-                constexpr void SetEventHashingFunction(const std::function<std::string(const std::shared_ptr<Event> &)> &func) noexcept {m_eventHashingFunction = func; m_eventHashingFunctionIsDefined = true;}
+                constexpr void SetEventHashingFunction(const std::function<EventKey(const std::shared_ptr<Event> &)> &func) noexcept {m_eventHashingFunction = func; m_eventHashingFunctionIsDefined = true;}
                 /**
                  * @brief Set the Event Hashing Function object.
                  * 
                  * @param func Function object, can be lambda, standard function or std::function object.
                  */
-                constexpr void SetEventHashingFunction(std::function<std::string(const std::shared_ptr<Event> &)> &&func) noexcept {m_eventHashingFunction = std::move(func);  m_eventHashingFunctionIsDefined = true;}
+                constexpr void SetEventHashingFunction(std::function<EventKey(const std::shared_ptr<Event> &)> &&func) noexcept {m_eventHashingFunction = std::move(func);  m_eventHashingFunctionIsDefined = true;}
                 /**
                  * @brief Get the corresponding hash for given Event object.
                  * 
                  * @param obj Event-type object
-                 * @return std::string 
+                 * @return EventKey 
                  */
-                [[nodiscard]] std::string GetEventHash(const std::shared_ptr<Event> &obj) const noexcept {return m_eventHashingFunction(obj);}
+                [[nodiscard]] EventKey GetEventHash(const std::shared_ptr<Event> &obj) const noexcept {return m_eventHashingFunction(obj);}
                 /**
                  * @brief Set the Pair Hashing Function object.
                  * 
                  * @param func Function object, can be lambda, standard function or std::function object.
                  */
-                constexpr void SetPairHashingFunction(const std::function<std::string(const std::shared_ptr<Pair> &)> &func) noexcept {m_pairHashingFunction = func; m_pairHashingFunctionIsDefined = true;}
+                constexpr void SetPairHashingFunction(const std::function<PairKey(const std::shared_ptr<Pair> &)> &func) noexcept {m_pairHashingFunction = func; m_pairHashingFunctionIsDefined = true;}
                 /**
                  * @brief Set the Pair Hashing Function object.
                  * 
                  * @param func Function object, can be lambda, standard function or std::function object.
                  */
-                constexpr void SetPairHashingFunction(std::function<std::string(const std::shared_ptr<Pair> &)> &&func) noexcept {m_pairHashingFunction = std::move(func); m_pairHashingFunctionIsDefined = true;}
+                constexpr void SetPairHashingFunction(std::function<PairKey(const std::shared_ptr<Pair> &)> &&func) noexcept {m_pairHashingFunction = std::move(func); m_pairHashingFunctionIsDefined = true;}
                 /**
                  * @brief Get the corresponding hash for given Pair object.
                  * 
                  * @param obj Pair-type object.
-                 * @return std::string 
+                 * @return PairKey 
                  */
-                [[nodiscard]] std::string GetPairHash(const std::shared_ptr<Pair> &obj) const noexcept {return m_pairHashingFunction(obj);}
+                [[nodiscard]] PairKey GetPairHash(const std::shared_ptr<Pair> &obj) const noexcept {return m_pairHashingFunction(obj);}
                 /**
                  * @brief Set the Pair Cutting Function object. The function should return true if pair should be rejected and false if accepted.
                  * 
@@ -128,11 +542,30 @@
                  */
                 [[nodiscard]] constexpr bool GetPairCutResult(const std::shared_ptr<Pair> &obj) const noexcept {return m_pairCutFunction(obj);}
                 /**
-                 * @brief Set the max mixing buffer size for each "branch".
+                 * @brief Set the pair pre-cut. It is applied to the qInv, kT and opening angle of each combination of tracks before the pair object is constructed, so the rejected pairs cost only a few arithmetic operations.
+                 * The variables are computed for blocks of pairs at once from tracks converted to the structure-of-arrays layout, which lets the compiler use SIMD instructions.
+                 * Requires a specialisation of Mixing::TrackKinematics for the track type. Pairs rejected by the pre-cut are not built at all (they don't show up in the "bad" group).
+                 * 
+                 * @param preCut Pre-cut values.
+                 */
+                void SetPairPreCut(const JJPairPreCut &preCut) noexcept
+                {
+                    static_assert(Detail::HasTrackKinematics<Track>::value,"Pair pre-cut requires a specialisation of Mixing::TrackKinematics for the track type!");
+                    m_pairPreCut = preCut;
+                    m_pairPreCutIsDefined = true;
+                }
+                /**
+                 * @brief Get the pair pre-cut.
+                 * 
+                 * @return JJPairPreCut 
+                 */
+                [[nodiscard]] constexpr JJPairPreCut GetPairPreCut() const noexcept {return m_pairPreCut;}
+                /**
+                 * @brief Set the max mixing buffer size for each "branch". Buffers which already hold more events keep only the newest ones. With size 0 no events are buffered, so there is no background.
                  * 
                  * @param buffer Max buffer size.
                  */
-                constexpr void SetMaxBufferSize(std::size_t buffer) noexcept {m_bufferSize = buffer;}
+                void SetMaxBufferSize(std::size_t buffer);
                 /**
                  * @brief Get the max mixing buffer size.
                  * 
@@ -152,6 +585,131 @@
                  * @return false - Mixnig with any size.
                  */
                 [[nodiscard]] constexpr bool GetBufferState() const noexcept {return m_waitForBuffer;};
+                /**
+                 * @brief Set the seed of the random number generators used to select the tracks stored in the mixing buffer. Each event class has its own generator seeded from this seed and the class key, so the selection is reproducible for given seed and order of events within each class.
+                 * The generators of the classes which are already buffered are reseeded. By default the seed is random.
+                 * 
+                 * @param seed Seed value.
+                 */
+                void SetSeed(std::uint_fast32_t seed);
+                /**
+                 * @brief Get the seed of the random number generators.
+                 * 
+                 * @return std::uint_fast32_t 
+                 */
+                [[nodiscard]] constexpr std::uint_fast32_t GetSeed() const noexcept {return m_seed;}
+                /**
+                 * @brief Set the number of tracks stored in the mixing buffer for each event (randomly selected without repetition, copied by value). Tracks from the same buffered event are never paired with each other.
+                 * Events which were already buffered keep their tracks.
+                 * 
+                 * @param nTracks Number of tracks, at least 1 (default).
+                 */
+                void SetTracksPerEvent(std::size_t nTracks);
+                /**
+                 * @brief Get the number of tracks stored in the mixing buffer for each event.
+                 * 
+                 * @return std::size_t
+                 */
+                [[nodiscard]] constexpr std::size_t GetTracksPerEvent() const noexcept {return m_tracksPerEvent;}
+                /**
+                 * @brief Set the memory budget of the mixing buffers and the background pair cache. Whenever an event makes the estimated usage (see GetMemoryUsage) exceed the budget, the classes which did not receive events for the longest time are removed.
+                 * The class of the current event is always kept.
+                 * 
+                 * @param bytes Budget in bytes, 0 (default) for no limit.
+                 */
+                void SetMemoryBudget(std::size_t bytes);
+                /**
+                 * @brief Get the memory budget of the mixing buffers and the background pair cache.
+                 * 
+                 * @return std::size_t Budget in bytes, 0 means no limit.
+                 */
+                [[nodiscard]] constexpr std::size_t GetMemoryBudget() const noexcept {return m_memoryBudget;}
+                /**
+                 * @brief Get the estimated memory taken by the mixing buffers (full buffers are assumed) and the background pair cache of all event classes.
+                 * 
+                 * @return std::size_t Bytes.
+                 */
+                [[nodiscard]] std::size_t GetMemoryUsage() const noexcept {return m_similarityMap.size() * GetClassBytes() + m_cacheBytes;}
+                /**
+                 * @brief Get the number of event classes removed so far to stay within the memory budget.
+                 * 
+                 * @return std::size_t
+                 */
+                [[nodiscard]] constexpr std::size_t GetNEvictedClasses() const noexcept {return m_evictedClasses;}
+                /**
+                 * @brief Enable or disable the background pair cache. When enabled, each event class keeps the pairs of its buffered tracks (with their cut result and group).
+                 * AddEvent builds only the pairs of the new track and drops the pairs of the removed one, so GetSimilarPairs and ForEachBackgroundPair cost O(B) instead of O(B^2) pair constructions for a buffer of size B.
+                 * The pairs are the same as without the cache (with the same order of the two tracks), only the order of the pairs within a group can differ.
+                 * The hashing and cut functions have to be set before enabling the cache, since the cached results are not recomputed.
+                 * 
+                 * @param cache Set true to enable the cache.
+                 */
+                void SetBackgroundPairCaching(bool cache);
+                /**
+                 * @brief Get the background pair cache flag.
+                 * 
+                 * @return true - Background pairs are cached.
+                 * @return false - Background pairs are built on each call.
+                 */
+                [[nodiscard]] constexpr bool GetBackgroundPairCaching() const noexcept {return m_cacheBackgroundPairs;}
+                /**
+                 * @brief Enable or disable the performance counters and stage timers. When disabled (default) the instrumentation costs a single check per call (and per pair).
+                 * 
+                 * @param enable Set true to collect the counters.
+                 */
+                constexpr void EnableCounters(bool enable) noexcept {m_countersEnabled = enable;}
+                /**
+                 * @brief Get the performance counters flag.
+                 * 
+                 * @return true - Counters are collected.
+                 * @return false - Counters are not collected.
+                 */
+                [[nodiscard]] constexpr bool GetCountersState() const noexcept {return m_countersEnabled;}
+                /**
+                 * @brief Get the collected performance counters and stage timers.
+                 * 
+                 * @return const JJMixerCounters& 
+                 */
+                [[nodiscard]] const JJMixerCounters& GetCounters() const noexcept {return m_counters;}
+                /**
+                 * @brief Set all performance counters and stage timers to zero.
+                 * 
+                 */
+                void ResetCounters() noexcept {m_counters = JJMixerCounters();}
+                /**
+                 * @brief Prints to the standard output the collected performance counters and stage timers.
+                 * 
+                 */
+                void PrintCounters() const {m_counters.Print();}
+                /**
+                 * @brief Write the mixing buffers (event IDs and tracks of all event classes) and the pop counters to a binary snapshot. Requires a Mixing::TrackSerializer specialisation for the track type.
+                 * 
+                 * @param stream output stream (opened in binary mode)
+                 * @throws std::runtime_error if writing failed
+                 */
+                void SaveBuffers(std::ostream &stream) const;
+                /**
+                 * @brief Write the mixing buffers and the pop counters to a binary snapshot file.
+                 * 
+                 * @param fileName path to the file, overwritten if it exists
+                 * @throws std::runtime_error if the file could not be written
+                 */
+                void SaveBuffers(const std::string &fileName) const;
+                /**
+                 * @brief Replace the mixing buffers and the pop counters with the content of a snapshot, e.g. one made by the previous job. If a buffer in the snapshot is longer than the current buffer size, only the newest tracks are kept (the others count as popped).
+                 * The view can point to a memory-mapped file. The background pair cache is rebuilt if enabled.
+                 * 
+                 * @param snapshot snapshot view
+                 * @throws std::runtime_error if the snapshot does not match the track serializer or the event key type
+                 */
+                void LoadBuffers(const JJBufferSnapshotView &snapshot);
+                /**
+                 * @brief Replace the mixing buffers and the pop counters with the content of a snapshot file.
+                 * 
+                 * @param fileName path to the file
+                 * @throws std::runtime_error if the file could not be read or is not a valid snapshot
+                 */
+                void LoadBuffers(const std::string &fileName);
                 /**
                  * @brief Prints to the standard output information about current setup of JJFemtoMixer.
                  * 
@@ -167,139 +725,819 @@
                  * 
                  * @param event Current event.
                  * @param tracks Tracks from the current event.
-                 * @return std::map<std::string, std::vector<Pair> > Sorted pairs from provided tracks for given event.
+                 * @return PairMap Sorted pairs from provided tracks for given event.
                  */
-                std::map<std::string, std::vector<std::shared_ptr<Pair> > > AddEvent(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks) noexcept;
+                PairMap AddEvent(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks) noexcept;
                 /**
                  * @brief Get the sorted pairs which come from similar events, but not from this event.
                  * 
                  * @param event Current event (the event from which we don't want to get tracks).
-                 * @return std::map<std::string, std::vector<Pair> > Sorted pairs from stored tracks for similar events.
+                 * @return PairMap Sorted pairs from stored tracks for similar events.
                  */
-                [[nodiscard]] std::map<std::string, std::vector<std::shared_ptr<Pair> > > GetSimilarPairs(const std::shared_ptr<Event> &event) const noexcept;
+                [[nodiscard]] PairMap GetSimilarPairs(const std::shared_ptr<Event> &event) const noexcept;
+                /**
+                 * @brief Add currently processed event to the mixer and build its pairs by value in an arena owned by the mixer. No pair is allocated on the heap and the arena memory is reused, so the steady-state processing does no pair allocations.
+                 * The pair hashing and cut functions receive a non-owning std::shared_ptr to the arena pair, they must not store it.
+                 * 
+                 * @param event Current event.
+                 * @param tracks Tracks from the current event.
+                 * @return const PairArena& Sorted pairs from provided tracks for given event. Valid until the next call of this method.
+                 */
+                const PairArena& AddEventByValue(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks);
+                /**
+                 * @brief Get the sorted pairs which come from similar events, but not from this event, built by value in an arena owned by the mixer.
+                 * The pair hashing and cut functions receive a non-owning std::shared_ptr to the arena pair, they must not store it.
+                 * 
+                 * @param event Current event (the event from which we don't want to get tracks).
+                 * @return const PairArena& Sorted pairs from stored tracks for similar events. Valid until the next call of this method.
+                 */
+                const PairArena& GetSimilarPairsByValue(const std::shared_ptr<Event> &event);
+                /**
+                 * @brief Add currently processed event to the mixer and pass each of its pairs, together with its group, to the visitor. Nothing is stored in between, so the memory usage does not depend on the multiplicity.
+                 * The pair hashing and cut functions receive a non-owning std::shared_ptr to the pair, they must not store it.
+                 * 
+                 * @tparam Visitor callable with signature void(const PairKey &, const Pair &)
+                 * @param event Current event.
+                 * @param tracks Tracks from the current event.
+                 * @param visitor Function called for each pair, e.g. filling the histogram of the group. The pair is destroyed when the visitor returns.
+                 */
+                template<typename Visitor>
+                void ForEachSignalPair(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks, Visitor &&visitor);
+                /**
+                 * @brief Pass each pair which comes from similar events, but not from this event, together with its group, to the visitor. Nothing is stored in between.
+                 * The pair hashing and cut functions receive a non-owning std::shared_ptr to the pair, they must not store it.
+                 * 
+                 * @tparam Visitor callable with signature void(const PairKey &, const Pair &)
+                 * @param event Current event (the event from which we don't want to get tracks).
+                 * @param visitor Function called for each pair. The pair is destroyed when the visitor returns.
+                 */
+                template<typename Visitor>
+                void ForEachBackgroundPair(const std::shared_ptr<Event> &event, Visitor &&visitor) const;
         };
 
-        template<typename Event, typename Track, typename Pair>
-        std::vector<std::shared_ptr<Pair> > JJFemtoMixer<Event,Track,Pair>::MakePairs(const std::vector<std::shared_ptr<Track> > &tracks) const noexcept
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        template<typename Func>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::ForEachTrackCombination(const std::vector<std::shared_ptr<Track> > &tracks, const TrackLayout &layout, Func &&func) const
+        {
+            if (UsesPairPreCut())
+            {
+                JJTrackSoA soa;
+                if constexpr (Detail::HasTrackKinematics<Track>::value)
+                    soa.Assign(tracks);
+                ForEachTrackCombinationInRows(tracks,layout,&soa,0,tracks.size(),std::forward<Func>(func));
+            }
+            else
+            {
+                ForEachTrackCombinationInRows(tracks,layout,nullptr,0,tracks.size(),std::forward<Func>(func));
+            }
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        std::size_t JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::CountCombinations(std::size_t nTracks, const std::vector<std::size_t> &partnerBegin, std::size_t rowBegin, std::size_t rowEnd) noexcept
+        {
+            if (partnerBegin.empty())
+            {
+                // rows i in [rowBegin, rowEnd) of the triangle have N-1-i pairs each
+                const auto pairsBefore = [nTracks](std::size_t row){return row * (2 * nTracks - row - 1) / 2;};
+                return (rowBegin < rowEnd) ? pairsBefore(rowEnd) - pairsBefore(rowBegin) : 0;
+            }
+
+            std::size_t nPairs = 0;
+            for (std::size_t row = rowBegin; row < rowEnd; ++row)
+                nPairs += nTracks - partnerBegin[row];
+
+            return nPairs;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        template<typename Func>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::ForEachTrackCombinationInRows(const std::vector<std::shared_ptr<Track> > &tracks, const TrackLayout &layout, const JJTrackSoA *soa, std::size_t rowBegin, std::size_t rowEnd, Func &&func) const
         {
-            bool reverse = false;
             std::size_t trckSize = tracks.size();
+            const std::vector<std::size_t> &partnerBegin = layout.partnerBegin;
+            const std::vector<std::uint8_t> &parity = layout.parity;
+            // tracks of a single event: the orientation alternates with the index of the pair in the full list of combinations
+            // buffered tracks: the orientation depends only on the parities of the two tracks
+            bool reverse = parity.empty() && CountCombinations(trckSize,partnerBegin,0,rowBegin) % 2 == 1;
 
-            std::vector<std::shared_ptr<Pair> > tmpVector;
-            tmpVector.reserve(trckSize * (trckSize - 1) / 2); // reserve the expected number of pairs
+            if (soa != nullptr)
+            {
+                for (std::size_t iter1 = rowBegin; iter1 < rowEnd; ++iter1)
+                {
+                    const bool rowReverse = reverse;
+                    const std::size_t begin = (partnerBegin.empty()) ? iter1 + 1 : partnerBegin[iter1];
+                    ForEachPreCutPartner(*soa,iter1,begin,trckSize,[&tracks,&parity,&func,iter1,begin,rowReverse](std::size_t iter2)
+                    {
+                        const bool pairReverse = (parity.empty()) ? rowReverse != ((iter2 - begin) % 2 == 1) : parity[iter1] != parity[iter2];
+                        if (pairReverse)
+                            func(tracks[iter2],tracks[iter1]);
+                        else
+                            func(tracks[iter1],tracks[iter2]);
+                    });
+                    if (parity.empty() && (trckSize - begin) % 2 == 1)
+                        reverse = !reverse;
+                }
+
+                return;
+            }
 
-            for (std::size_t iter1 = 0; iter1 < trckSize; ++iter1)
-                for (std::size_t iter2 = iter1 + 1; iter2 < trckSize; ++iter2)
+            for (std::size_t iter1 = rowBegin; iter1 < rowEnd; ++iter1)
+                for (std::size_t iter2 = (partnerBegin.empty()) ? iter1 + 1 : partnerBegin[iter1]; iter2 < trckSize; ++iter2)
                 {
-                    if (reverse)
-                        tmpVector.emplace_back(new Pair(tracks[iter2],tracks[iter1]));
+                    const bool pairReverse = (parity.empty()) ? reverse : parity[iter1] != parity[iter2];
+                    if (pairReverse)
+                        func(tracks[iter2],tracks[iter1]);
                     else
-                        tmpVector.emplace_back(new Pair(tracks[iter1],tracks[iter2]));
+                        func(tracks[iter1],tracks[iter2]);
 
                     reverse = !reverse; // reverse the order of tracks every other time (get rid of the bias from the track sorter)
                 }
+        }
 
-            return tmpVector;
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        template<typename Func>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::ForEachPreCutPartner(const JJTrackSoA &soa, std::size_t first, std::size_t begin, std::size_t end, Func &&func) const
+        {
+            std::uint8_t accepted[JJTrackSoA::BlockSize];
+
+            for (std::size_t blockBegin = begin; blockBegin < end; blockBegin += JJTrackSoA::BlockSize)
+            {
+                const std::size_t blockEnd = std::min(blockBegin + JJTrackSoA::BlockSize,end);
+                soa.PreCutBlock(first,blockBegin,blockEnd,m_pairPreCut,accepted);
+
+                if (m_countersEnabled)
+                {
+                    std::size_t nAccepted = 0;
+                    for (std::size_t iter = 0; iter < blockEnd - blockBegin; ++iter)
+                        nAccepted += accepted[iter];
+                    m_counters.pairsPreCut += (blockEnd - blockBegin) - nAccepted;
+                }
+
+                for (std::size_t iter = blockBegin; iter < blockEnd; ++iter)
+                    if (accepted[iter - blockBegin])
+                        func(iter);
+            }
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        typename JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::ClassBuffer& JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::GetClassBuffer(const EventKey &evtHash)
+        {
+            if (auto found = m_similarityMap.find(evtHash); found != m_similarityMap.end())
+            {
+                m_classesByFill.erase(found->second.lastFilled);
+                found->second.lastFilled = m_fillClock++;
+                m_classesByFill.emplace(found->second.lastFilled,evtHash);
+                return found->second;
+            }
+
+            m_classesByFill.emplace(m_fillClock,evtHash);
+
+            return m_similarityMap.try_emplace(evtHash,ClassBuffer{Buffer(m_bufferSize,m_reuseTrackStorage),0,PairCache(),0,m_fillClock++,MakeClassGenerator(evtHash)}).first->second;
         }
 
-        template<typename Event, typename Track, typename Pair>
-        std::map<std::string, std::vector<std::shared_ptr<Pair> > > JJFemtoMixer<Event,Track,Pair>::SortPairs(const std::vector<std::shared_ptr<Pair> > &pairs) const noexcept
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        typename JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::ClassRandomGenerator JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::MakeClassGenerator(const EventKey &evtHash) const
         {
-            std::string currentPairHash = "0";
-            std::map<std::string, std::vector<std::shared_ptr<Pair> > > pairMap;
+            const std::uint64_t keyHash = static_cast<std::uint64_t>(std::hash<EventKey>{}(evtHash));
+            std::seed_seq sequence{static_cast<std::uint32_t>(m_seed),static_cast<std::uint32_t>(keyHash),static_cast<std::uint32_t>(keyHash >> 32)};
+            return ClassRandomGenerator(sequence);
+        }
 
-            for (const auto &pair : pairs)
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::EvictClasses()
+        {
+            if (m_memoryBudget == 0)
+                return;
+
+            while (m_classesByFill.size() > 1 && GetMemoryUsage() > m_memoryBudget)
+                EvictLeastRecentClass();
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::EvictLeastRecentClass()
+        {
+            const auto oldest = m_classesByFill.begin();
+            m_cacheBytes -= m_similarityMap.find(oldest->second)->second.cacheBytes;
+            m_similarityMap.erase(oldest->second);
+            m_classesByFill.erase(oldest);
+            ++m_evictedClasses;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        const typename JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::ClassBuffer* JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::GetLeastRecentClass() const
+        {
+            if (m_classesByFill.empty())
+                return nullptr;
+
+            return &m_similarityMap.find(m_classesByFill.begin()->second)->second;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::CountCachedPairs(ClassBuffer &classBuffer, const std::deque<std::vector<CachedPair> > &entryPairs, bool add) noexcept
+        {
+            std::size_t bytes = 0;
+            for (const auto &pairs : entryPairs)
+                bytes += GetCachedPairsBytes(pairs);
+
+            if (add)
+            {
+                classBuffer.cacheBytes += bytes;
+                m_cacheBytes += bytes;
+            }
+            else
+            {
+                classBuffer.cacheBytes -= bytes;
+                m_cacheBytes -= bytes;
+            }
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::SampleTracks(const std::vector<std::shared_ptr<Track> > &tracks, typename Buffer::TrackBlock &stored, ClassRandomGenerator &generator) const
+        {
+            const std::size_t trckSize = tracks.size();
+            if (trckSize == 0)
+                return;
+
+            if (m_tracksPerEvent == 1)
             {
-                if (m_pairCutFunction(pair))
+                stored.push_back(**JJUtils::select_randomly(tracks.begin(),tracks.end(),generator));
+                return;
+            }
+
+            stored.reserve(std::min(m_tracksPerEvent,trckSize));
+            if (m_tracksPerEvent >= trckSize)
+            {
+                for (const auto &trck : tracks)
+                    stored.push_back(*trck);
+                return;
+            }
+
+            // partial Fisher-Yates shuffle of the indices, the first m_tracksPerEvent of them are the sample
+            std::vector<std::size_t> indices(trckSize);
+            for (std::size_t iter = 0; iter < trckSize; ++iter)
+                indices[iter] = iter;
+
+            for (std::size_t iter = 0; iter < m_tracksPerEvent; ++iter)
+            {
+                std::uniform_int_distribution<std::size_t> dist(iter,trckSize - 1);
+                std::swap(indices[iter],indices[dist(generator)]);
+                stored.push_back(*tracks[indices[iter]]);
+            }
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::StoreEvent(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks)
+        {
+            Detail::StageTimer timer(CounterTarget(&JJMixerCounters::storeNanoseconds));
+            ClassBuffer &classBuffer = GetClassBuffer(m_eventHashingFunction(event));
+            Buffer &buffer = classBuffer.ring;
+
+            if (buffer.capacity() == 0)
+            {
+                // buffer size 0: nothing is buffered, every event is popped straight away
+                classBuffer.popCounter++;
+                EvictClasses();
+                return;
+            }
+
+            if (buffer.full())
+            {
+                classBuffer.popCounter++;
+
+                if (m_cacheBackgroundPairs)
+                {
+                    // the oldest entry is the first partner of every other entry, its pairs have to be released before its slot is reused
+                    CountCachedPairs(classBuffer,classBuffer.pairCache.front(),false);
+                    classBuffer.pairCache.pop_front();
+                    for (auto &entryPairs : classBuffer.pairCache)
+                    {
+                        classBuffer.cacheBytes -= GetCachedPairsBytes(entryPairs.front());
+                        m_cacheBytes -= GetCachedPairsBytes(entryPairs.front());
+                        entryPairs.pop_front();
+                    }
+                }
+            }
+
+            SampleTracks(tracks,buffer.Push(Detail::EventIdOf(*event)),classBuffer.randomGenerator);
+
+            if (m_cacheBackgroundPairs)
+            {
+                // only the pairs of the new tracks are built, all other pairs are already in the cache
+                classBuffer.pairCache.push_back(MakeCachedPairs(buffer,buffer.size() - 1));
+                CountCachedPairs(classBuffer,classBuffer.pairCache.back(),true);
+            }
+
+            // the growth of the cache counts too, so the budget is checked after every event (classBuffer is not used afterwards, eviction may move it)
+            EvictClasses();
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        std::deque<std::vector<typename JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::CachedPair> > JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::MakeCachedPairs(const Buffer &buffer, std::size_t entry) const
+        {
+            const std::size_t nNewTracks = buffer[entry].tracks->size();
+            std::deque<std::vector<CachedPair> > entryPairs(entry);
+
+            auto makePair = [this,&buffer,&entryPairs,entry](std::size_t partner, std::size_t newTrack, std::size_t partnerTrack)
+            {
+                std::shared_ptr<Track> trck1 = buffer.GetTrack(entry,newTrack), trck2 = buffer.GetTrack(partner,partnerTrack);
+                // reversed when the parities of the two tracks differ, the same way as for the freshly built background pairs (see ForEachTrackCombination)
+                // the difference of the parities does not change when the buffer slides, so the cached pair stays valid
+                std::shared_ptr<Pair> pair = ((entry + newTrack + partner + partnerTrack) % 2 == 1) ? std::make_shared<Pair>(trck1,trck2) : std::make_shared<Pair>(trck2,trck1);
+                PairKey key = ClassifyPair(pair);
+                entryPairs[partner].push_back(CachedPair{std::move(pair),std::move(key)});
+                if (m_countersEnabled)
+                    m_counters.bytesAllocated += Detail::SharedObjectBytes<Pair>() + sizeof(CachedPair);
+            };
+
+            if (UsesPairPreCut())
+            {
+                if constexpr (Detail::HasTrackKinematics<Track>::value)
                 {
-                    currentPairHash = "bad";
+                    // tracks of entries 0..entry in a flat list (the new tracks last), with the entry and the track index of each
+                    std::vector<std::shared_ptr<Track> > bufferTracks;
+                    std::vector<std::pair<std::size_t,std::size_t> > origin;
+                    for (std::size_t partner = 0; partner <= entry; ++partner)
+                        for (std::size_t track = 0; track < buffer[partner].tracks->size(); ++track)
+                        {
+                            bufferTracks.push_back(buffer.GetTrack(partner,track));
+                            origin.emplace_back(partner,track);
+                        }
+
+                    JJTrackSoA soa;
+                    soa.Assign(bufferTracks);
+                    const std::size_t nPartnerTracks = bufferTracks.size() - nNewTracks;
+                    for (std::size_t newTrack = 0; newTrack < nNewTracks; ++newTrack)
+                        ForEachPreCutPartner(soa,nPartnerTracks + newTrack,0,nPartnerTracks,[&makePair,&origin,newTrack](std::size_t iter)
+                        {
+                            makePair(origin[iter].first,newTrack,origin[iter].second);
+                        });
                 }
-                else
+            }
+            else
+            {
+                for (std::size_t partner = 0; partner < entry; ++partner)
+                    for (std::size_t newTrack = 0; newTrack < nNewTracks; ++newTrack)
+                        for (std::size_t partnerTrack = 0; partnerTrack < buffer[partner].tracks->size(); ++partnerTrack)
+                            makePair(partner,newTrack,partnerTrack);
+            }
+
+            return entryPairs;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::RebuildPairCache()
+        {
+            m_cacheBytes = 0;
+            for (auto &[evtHash,classBuffer] : m_similarityMap)
+            {
+                classBuffer.pairCache.clear();
+                classBuffer.cacheBytes = 0;
+                if (! m_cacheBackgroundPairs)
+                    continue;
+
+                for (std::size_t entry = 0; entry < classBuffer.ring.size(); ++entry)
                 {
-                    currentPairHash = m_pairHashingFunction(pair);
+                    classBuffer.pairCache.push_back(MakeCachedPairs(classBuffer.ring,entry));
+                    CountCachedPairs(classBuffer,classBuffer.pairCache.back(),true);
                 }
+            }
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::ClearBuffers() noexcept
+        {
+            m_similarityMap.clear();
+            m_classesByFill.clear();
+            m_cacheBytes = 0;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::AddBuffersToSnapshot(JJBufferSnapshotWriter<Track,EventKey> &writer) const
+        {
+            for (const auto &[evtHash,classBuffer] : m_similarityMap)
+                writer.AddClass(evtHash,classBuffer.popCounter,classBuffer.ring);
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::LoadBufferClass(const JJBufferSnapshotView &snapshot, std::size_t evtClass, const EventKey &evtHash)
+        {
+            const std::size_t nEntries = snapshot.GetNEntries(evtClass);
+            const std::size_t nSkipped = (nEntries > m_bufferSize) ? nEntries - m_bufferSize : 0;
+
+            ClassBuffer &classBuffer = GetClassBuffer(evtHash);
+            classBuffer.ring.clear();
+            classBuffer.pairCache.clear();
+            m_cacheBytes -= classBuffer.cacheBytes;
+            classBuffer.cacheBytes = 0;
+            for (std::size_t entry = nSkipped; entry < nEntries; ++entry)
+            {
+                auto &stored = classBuffer.ring.Push(snapshot.GetEventID(evtClass,entry));
+                const std::size_t nTracks = std::min(snapshot.GetNTracks(evtClass,entry),m_tracksPerEvent);
+                for (std::size_t track = 0; track < nTracks; ++track)
+                    stored.push_back(TrackSerializer<Track>::Read(snapshot.GetTrackData(evtClass,entry,track)));
+            }
+
+            classBuffer.popCounter = snapshot.GetPopCounter(evtClass) + nSkipped;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::SaveBuffers(std::ostream &stream) const
+        {
+            JJBufferSnapshotWriter<Track,EventKey> writer(m_bufferSize);
+            AddBuffersToSnapshot(writer);
+            writer.Write(stream);
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::SaveBuffers(const std::string &fileName) const
+        {
+            std::ofstream file(fileName,std::ios::binary | std::ios::trunc);
+            if (! file)
+                throw std::runtime_error("JJBufferSnapshot: cannot open " + fileName);
+
+            SaveBuffers(file);
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::LoadBuffers(const JJBufferSnapshotView &snapshot)
+        {
+            static_assert(Detail::HasTrackSerializer<Track>::value,"Mixing::TrackSerializer has to be specialised for the track type to load the mixing buffers!");
+            if (snapshot.GetTrackSize() != TrackSerializer<Track>::Size)
+                throw std::runtime_error("JJBufferSnapshot: track record size does not match the track serializer");
+            snapshot.CheckKeyType<EventKey>();
+
+            // decode all keys first, so that a mismatching snapshot leaves the buffers untouched
+            std::vector<EventKey> keys;
+            keys.reserve(snapshot.GetNClasses());
+            for (std::size_t evtClass = 0; evtClass < snapshot.GetNClasses(); ++evtClass)
+                keys.push_back(Detail::KeyCodec<EventKey>::Decode(snapshot.GetClassKey(evtClass)));
+
+            ClearBuffers();
+            for (std::size_t evtClass = 0; evtClass < keys.size(); ++evtClass)
+                LoadBufferClass(snapshot,evtClass,keys[evtClass]);
+
+            RebuildPairCache();
+            EvictClasses();
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::LoadBuffers(const std::string &fileName)
+        {
+            const std::vector<unsigned char> data = Detail::ReadSnapshotFile(fileName);
+            LoadBuffers(JJBufferSnapshotView(data.data(),data.size()));
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::SetMaxBufferSize(std::size_t buffer)
+        {
+            m_bufferSize = buffer;
+
+            bool removedEvents = false;
+            for (auto &[evtHash,classBuffer] : m_similarityMap)
+            {
+                const std::size_t nRemoved = classBuffer.ring.SetCapacity(buffer);
+                classBuffer.popCounter += nRemoved;
+                removedEvents |= (nRemoved > 0);
+            }
+
+            // the cache is indexed by the position in the buffer, which changed
+            if (removedEvents)
+                RebuildPairCache();
+
+            EvictClasses();
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::SetSeed(std::uint_fast32_t seed)
+        {
+            m_seed = seed;
+            for (auto &[evtHash,classBuffer] : m_similarityMap)
+                classBuffer.randomGenerator = MakeClassGenerator(evtHash);
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::SetTracksPerEvent(std::size_t nTracks)
+        {
+            m_tracksPerEvent = (nTracks > 0) ? nTracks : 1;
+            EvictClasses();
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::SetMemoryBudget(std::size_t bytes)
+        {
+            m_memoryBudget = bytes;
+            EvictClasses();
+        }
 
-                // an entry for given currentPairHash may already exist so we must check if that's the case
-                if (pairMap.find(currentPairHash) != pairMap.end())
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::SetBackgroundPairCaching(bool cache)
+        {
+            if (cache != m_cacheBackgroundPairs)
+            {
+                m_cacheBackgroundPairs = cache;
+                RebuildPairCache();
+                EvictClasses();
+            }
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        template<typename Func>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::ForEachCachedPair(const std::shared_ptr<Event> &event, Func &&func) const
+        {
+            const auto found = m_similarityMap.find(m_eventHashingFunction(event));
+            if (found == m_similarityMap.end() || ! IsBufferReady(found->second.ring))
+                return;
+
+            const Buffer &buffer = found->second.ring;
+            const PairCache &pairCache = found->second.pairCache;
+            const std::uint64_t evtId = Detail::EventIdOf(*event);
+            for (std::size_t entry = 0; entry < buffer.size(); ++entry)
+            {
+                if (buffer[entry].eventId == evtId)
+                    continue;
+
+                const auto &entryPairs = pairCache[entry];
+                for (std::size_t partner = 0; partner < entry; ++partner)
                 {
-                    pairMap[currentPairHash].push_back(pair);
+                    if (buffer[partner].eventId == evtId)
+                        continue;
+
+                    for (const auto &cached : entryPairs[partner])
+                        func(cached);
                 }
-                else
+            }
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        typename JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::SimilarTracks JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::GetSimilarTracks(const std::shared_ptr<Event> &event) const
+        {
+            SimilarTracks output;
+            const auto found = m_similarityMap.find(m_eventHashingFunction(event));
+
+            if (found != m_similarityMap.end() && IsBufferReady(found->second.ring))
+            {
+                const Buffer &buffer = found->second.ring;
+                const std::uint64_t evtId = Detail::EventIdOf(*event);
+                bool severalTracks = false;
+
+                TrackLayout &layout = output.layout;
+                output.tracks.reserve(buffer.size() * m_tracksPerEvent);
+                layout.partnerBegin.reserve(buffer.size() * m_tracksPerEvent);
+                layout.parity.reserve(buffer.size() * m_tracksPerEvent);
+                for (std::size_t entry = 0; entry < buffer.size(); ++entry)
                 {
-                    pairMap.emplace(currentPairHash,std::vector<std::shared_ptr<Pair> >(1,pair));
+                    if (buffer[entry].eventId == evtId)
+                        continue;
+
+                    const std::size_t nTracks = buffer[entry].tracks->size();
+                    for (std::size_t track = 0; track < nTracks; ++track)
+                    {
+                        output.tracks.push_back(buffer.GetTrack(entry,track));
+                        // the entry index of the skipped event is kept, so that the parities are the same as in the background pair cache
+                        layout.parity.push_back(static_cast<std::uint8_t>((entry + track) % 2));
+                    }
+
+                    // tracks of the same event are never paired, the partners start with the next event
+                    layout.partnerBegin.insert(layout.partnerBegin.end(),nTracks,output.tracks.size());
+                    severalTracks |= (nTracks > 1);
                 }
+
+                // with a single track per event every track may be paired with all following ones
+                if (! severalTracks)
+                    layout.partnerBegin.clear();
+            }
+
+            return output;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        std::vector<std::shared_ptr<Pair> > JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::MakePairs(const std::vector<std::shared_ptr<Track> > &tracks, const TrackLayout &layout) const noexcept
+        {
+            std::vector<std::shared_ptr<Pair> > tmpVector;
+            tmpVector.reserve(CountCombinations(tracks.size(),layout.partnerBegin,0,tracks.size())); // reserve the expected number of pairs
+
+            ForEachTrackCombination(tracks,layout,[&tmpVector](const std::shared_ptr<Track> &trck1, const std::shared_ptr<Track> &trck2)
+            {
+                tmpVector.emplace_back(new Pair(trck1,trck2));
+            });
+
+            return tmpVector;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::FillArena(const std::vector<std::shared_ptr<Track> > &tracks, PairArena &arena, const TrackLayout &layout) const
+        {
+            arena.Reset();
+            arena.Reserve(CountCombinations(tracks.size(),layout.partnerBegin,0,tracks.size()));
+
+            {
+                Detail::StageTimer timer(CounterTarget(&JJMixerCounters::buildNanoseconds));
+                ForEachTrackCombination(tracks,layout,[this,&arena](const std::shared_ptr<Track> &trck1, const std::shared_ptr<Track> &trck2)
+                {
+                    Pair &pair = arena.Emplace(trck1,trck2);
+                    arena.AssignLast(ClassifyPair(MakeNonOwning(pair)));
+                });
+            }
+
+            Detail::StageTimer timer(CounterTarget(&JJMixerCounters::sortNanoseconds));
+            arena.BuildGroups();
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::FillArenaCounted(const std::vector<std::shared_ptr<Track> > &tracks, PairArena &arena, const TrackLayout &layout) const
+        {
+            const std::size_t bytesBefore = arena.GetAllocatedBytes();
+            FillArena(tracks,arena,layout);
+
+            if (m_countersEnabled)
+            {
+                // the arena memory is reused, so only its growth counts as an allocation
+                const std::size_t bytesAfter = arena.GetAllocatedBytes();
+                m_counters.bytesAllocated += (bytesAfter > bytesBefore) ? bytesAfter - bytesBefore : 0;
+                m_counters.groupsCreated += arena.GetNGroups();
+            }
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        typename JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::PairMap JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::MakeSortedPairs(const std::vector<std::shared_ptr<Track> > &tracks, const TrackLayout &layout) const
+        {
+            std::vector<std::shared_ptr<Pair> > pairs;
+            {
+                Detail::StageTimer timer(CounterTarget(&JJMixerCounters::buildNanoseconds));
+                pairs = MakePairs(tracks,layout);
+            }
+
+            PairMap pairMap;
+            {
+                Detail::StageTimer timer(CounterTarget(&JJMixerCounters::sortNanoseconds));
+                pairMap = SortPairs(pairs);
+            }
+
+            if (m_countersEnabled)
+            {
+                m_counters.groupsCreated += pairMap.size();
+                m_counters.bytesAllocated += pairs.size() * Detail::SharedObjectBytes<Pair>() + pairs.capacity() * sizeof(std::shared_ptr<Pair>);
+                for (const auto &[key,bucket] : pairMap)
+                    m_counters.bytesAllocated += bucket.capacity() * sizeof(std::shared_ptr<Pair>);
             }
 
             return pairMap;
         }
 
-        template<typename Event, typename Track, typename Pair>
-        void JJFemtoMixer<Event,Track,Pair>::PrintSettings() const noexcept
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        template<typename Visitor>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::VisitPairs(const std::vector<std::shared_ptr<Track> > &tracks, Visitor &&visitor, const TrackLayout &layout) const
+        {
+            static_assert(std::is_invocable<Visitor&,const PairKey&,const Pair&>::value,"Provided visitor is not callable with (const PairKey &, const Pair &)!");
+
+            ForEachTrackCombination(tracks,layout,[this,&visitor](const std::shared_ptr<Track> &trck1, const std::shared_ptr<Track> &trck2)
+            {
+                Pair pair(trck1,trck2);
+                visitor(ClassifyPair(MakeNonOwning(pair)),static_cast<const Pair&>(pair));
+            });
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        typename JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::PairMap JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::SortPairs(const std::vector<std::shared_ptr<Pair> > &pairs) const noexcept
+        {
+            PairMap pairMap;
+
+            for (const auto &pair : pairs)
+            {
+                // operator[] creates the bucket if it does not exist yet, so a single lookup per pair is enough
+                pairMap[ClassifyPair(pair)].push_back(pair);
+            }
+
+            return pairMap;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::PrintSettings() const noexcept
         {
             std::cout << "\n------=============== JJFemtoMixer Settings ===============------\n";
             std::cout << "Max Background Mixing Buffer Size: " << m_bufferSize << ((m_waitForBuffer) ? " (FIXED)\n" : " (FLEXIBLE)\n");
+            std::cout << "Tracks Per Buffered Event: " << m_tracksPerEvent << "\n";
+            std::cout << "Buffer Memory Budget: ";
+            if (m_memoryBudget > 0)
+                std::cout << " " << m_memoryBudget << " B\n";
+            else
+                std::cout << " Unlimited\n";
             std::cout << "Event Hashing Function: " << ((m_eventHashingFunctionIsDefined) ? " User-defined\n" : " Not set\n");
             std::cout << "Pair Hashing Function: " << ((m_pairHashingFunctionIsDefined) ? " User-defined\n" : " Not set\n");
             std::cout << "Pair Rejection Function: " << ((m_pairCutFunctionIsDefined) ? " User-defined\n" : " Not set\n");
+            std::cout << "Pair Pre-cut: ";
+            if (m_pairPreCutIsDefined)
+                std::cout << " qInv [" << m_pairPreCut.minQinv << "," << m_pairPreCut.maxQinv << "], kT [" << m_pairPreCut.minKt << "," << m_pairPreCut.maxKt << "], opening angle > " << m_pairPreCut.minOpeningAngle << "\n";
+            else
+                std::cout << " Not set\n";
+            std::cout << "Background Pair Cache: " << ((m_cacheBackgroundPairs) ? " Enabled\n" : " Disabled\n");
             std::cout << "------=====================================================------\n" << std::endl;
         }
 
-        template<typename Event, typename Track, typename Pair>
-        void JJFemtoMixer<Event,Track,Pair>::PrintStatus() const noexcept
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::PrintStatus() const noexcept
         {
             std::cout << "\n------================ JJFemtoMixer Status ================------\n";
             std::cout << "Stored events / total\tevent hash\ttimes poped\n";
             for (const auto &[key,val] : m_similarityMap)
             {
-                std::cout << "\t" << val.size() << "/" << m_bufferSize << "\t\t" << key << "\t\t" << m_bufferPopCounter.at(key) << "\n";
+                std::cout << "\t" << val.ring.size() << "/" << m_bufferSize << "\t\t" << key << "\t\t" << val.popCounter << "\n";
             }
+            std::cout << "Buffer memory (estimate): " << GetMemoryUsage() << " B / " << ((m_memoryBudget > 0) ? std::to_string(m_memoryBudget) + " B" : std::string("unlimited")) << "\tevicted classes: " << m_evictedClasses << "\n";
                 
             std::cout << "------=====================================================------\n" << std::endl;
         }
 
-        template<typename Event, typename Track, typename Pair>
-        std::map<std::string, std::vector<std::shared_ptr<Pair> > > JJFemtoMixer<Event,Track,Pair>::AddEvent(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks) noexcept
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        typename JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::PairMap JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::AddEvent(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks) noexcept
         {
-            std::string evtHash = m_eventHashingFunction(event);
-            std::pair<std::string, std::shared_ptr<Track> > trackPair{event->GetID(),*JJUtils::select_randomly(tracks.begin(),tracks.end())};
+            if (m_countersEnabled)
+                ++m_counters.signalCalls;
 
-            // an entry for given evtHash may not exist, so we must check if that's the case
-            if (m_similarityMap.find(evtHash) == m_similarityMap.end())
-            {
-                m_similarityMap.emplace(evtHash,std::deque<std::pair<std::string, std::shared_ptr<Track> > >(1,trackPair));
-                m_bufferPopCounter.emplace(evtHash,0);
-            }
-            else
+            StoreEvent(event,tracks);
+
+            return MakeSortedPairs(tracks);
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        typename JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::PairMap JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::GetSimilarPairs(const std::shared_ptr<Event> &event) const noexcept
+        {
+            if (m_countersEnabled)
+                ++m_counters.backgroundCalls;
+
+            if (m_cacheBackgroundPairs)
             {
-                m_similarityMap[evtHash].push_back(trackPair);
-                if (m_similarityMap[evtHash].size() > m_bufferSize)
+                Detail::StageTimer timer(CounterTarget(&JJMixerCounters::sortNanoseconds));
+                PairMap pairMap;
+                ForEachCachedPair(event,[&pairMap](const CachedPair &cached){pairMap[cached.key].push_back(cached.pair);});
+
+                if (m_countersEnabled)
                 {
-                    m_similarityMap[evtHash].pop_front(); 
-                    m_bufferPopCounter[evtHash]++;
+                    m_counters.groupsCreated += pairMap.size();
+                    for (const auto &[key,bucket] : pairMap)
+                        m_counters.bytesAllocated += bucket.capacity() * sizeof(std::shared_ptr<Pair>);
                 }
+                return pairMap;
             }
 
-            return SortPairs(MakePairs(tracks));
+            const SimilarTracks similar = GetSimilarTracks(event);
+            return MakeSortedPairs(similar.tracks,similar.layout);
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        const typename JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::PairArena& JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::AddEventByValue(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks)
+        {
+            if (m_countersEnabled)
+                ++m_counters.signalCalls;
+
+            StoreEvent(event,tracks);
+            FillArenaCounted(tracks,m_signalArena);
+
+            return m_signalArena;
         }
 
-        template<typename Event, typename Track, typename Pair>
-        std::map<std::string, std::vector<std::shared_ptr<Pair> > > JJFemtoMixer<Event,Track,Pair>::GetSimilarPairs(const std::shared_ptr<Event> &event) const noexcept
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        const typename JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::PairArena& JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::GetSimilarPairsByValue(const std::shared_ptr<Event> &event)
         {
-            std::vector<std::shared_ptr<Track> > outputVec;
-            std::string evtHash = m_eventHashingFunction(event);
+            if (m_countersEnabled)
+                ++m_counters.backgroundCalls;
 
-            if (m_similarityMap.at(evtHash).size() == m_bufferSize || m_waitForBuffer == false)
+            const SimilarTracks similar = GetSimilarTracks(event);
+            FillArenaCounted(similar.tracks,m_backgroundArena,similar.layout);
+
+            return m_backgroundArena;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        template<typename Visitor>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::ForEachSignalPair(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks, Visitor &&visitor)
+        {
+            if (m_countersEnabled)
+                ++m_counters.signalCalls;
+
+            StoreEvent(event,tracks);
+
+            Detail::StageTimer timer(CounterTarget(&JJMixerCounters::buildNanoseconds));
+            VisitPairs(tracks,std::forward<Visitor>(visitor));
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        template<typename Visitor>
+        void JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>::ForEachBackgroundPair(const std::shared_ptr<Event> &event, Visitor &&visitor) const
+        {
+            if (m_countersEnabled)
+                ++m_counters.backgroundCalls;
+
+            Detail::StageTimer timer(CounterTarget(&JJMixerCounters::buildNanoseconds));
+            if (m_cacheBackgroundPairs)
             {
-                for (const auto &[evtId,trck] : m_similarityMap.at(evtHash))
-                {
-                    if (evtId != event->GetID())
-                    {
-                        outputVec.push_back(trck);
-                    }
-                }
+                static_assert(std::is_invocable<Visitor&,const PairKey&,const Pair&>::value,"Provided visitor is not callable with (const PairKey &, const Pair &)!");
+                ForEachCachedPair(event,[&visitor](const CachedPair &cached){visitor(cached.key,static_cast<const Pair&>(*cached.pair));});
+                return;
             }
 
-            return SortPairs(MakePairs(outputVec));
+            const SimilarTracks similar = GetSimilarTracks(event);
+            VisitPairs(similar.tracks,std::forward<Visitor>(visitor),similar.layout);
         }
     } // namespace Mixing
     
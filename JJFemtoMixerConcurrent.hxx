@@ -0,0 +1,580 @@
+/**
+ * @file JJFemtoMixerConcurrent.hxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Thread-safe mixer with buffers sharded by the event hash
+ * @version 1.0
+ * @date 2024-12-09
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef JJFemtoMixerConcurrent_hxx
+    #define JJFemtoMixerConcurrent_hxx
+
+    #include <vector>
+    #include <mutex>
+    #include <atomic>
+    #include <thread>
+    #include <functional>
+    #include <memory>
+    #include <iostream>
+    #include <cstdint>
+    #include <algorithm>
+    #include <string>
+    #include "JJFemtoMixer.hxx"
+    #include "JJTaskPool.hxx"
+
+    namespace Mixing
+    {
+        /**
+         * @brief Thread-safe version of JJFemtoMixer. AddEvent() and GetSimilarPairs() may be called from several threads at the same time.
+         * The mixing buffers are divided into shards by the event hash, each shard has its own lock, so events from different classes never contend (unless they fall into the same shard).
+         * Each event class has its own random number generator (see JJFemtoMixer::SetSeed), so the selection of buffered tracks does not depend on the number of shards or on how the classes interleave.
+         * The pairs of large events are built in parallel by a pool of worker threads. The result is identical to the serial one.
+         * All of the setters have to be called before the mixer is used by more than one thread. The user-defined hashing and cut functions have to be safe to call concurrently.
+         *
+         * @tparam Event event type
+         * @tparam Track track type
+         * @tparam Pair pair type
+         * @tparam EventKey type returned by the event hashing function
+         * @tparam PairKey type returned by the pair hashing function
+         */
+        template<typename Event, typename Track, typename Pair, typename EventKey = std::string, typename PairKey = std::string>
+        class JJFemtoMixerConcurrent
+        {
+            public:
+                using Mixer = JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>;
+                using PairMap = typename Mixer::PairMap;
+
+            private:
+                /**
+                 * @brief Part of the mixing buffers guarded by a single lock
+                 *
+                 */
+                struct Shard
+                {
+                    std::mutex mutex;
+                    Mixer mixer;
+                };
+
+                Mixer m_prototype; // holds the settings and is used (read-only) for hashing and pair classification
+                std::vector<Shard> m_shards;
+                std::size_t m_parallelThreshold;
+                std::unique_ptr<JJUtils::TaskPool> m_taskPool;
+                std::atomic<std::uint64_t> m_fillClock; // orders the event classes of all shards by their last use
+                std::atomic<std::size_t> m_memoryUsage,m_evictedClasses; // estimated memory of all shards (see JJFemtoMixer::GetMemoryUsage) and classes evicted to keep it within the budget
+                std::mutex m_evictionMutex; // only one thread evicts at a time, so that concurrent calls do not remove more classes than needed
+
+                /**
+                 * @brief Get the shard responsible for given event class
+                 *
+                 * @param evtHash event hash
+                 * @return Shard&
+                 */
+                [[nodiscard]] Shard& GetShard(const EventKey &evtHash)
+                {
+                    std::uint64_t hash = static_cast<std::uint64_t>(std::hash<EventKey>{}(evtHash));
+                    hash ^= hash >> 33;
+                    hash *= 0xff51afd7ed558ccdULL;
+                    hash ^= hash >> 33;
+                    return m_shards[hash % m_shards.size()];
+                }
+                /**
+                 * @brief Apply given function to the prototype and all of the shard mixers
+                 *
+                 * @tparam Func callable with signature void(Mixer &)
+                 * @param func function applied to each mixer
+                 */
+                template<typename Func>
+                void ForEachMixer(Func &&func)
+                {
+                    func(m_prototype);
+                    for (auto &shard : m_shards)
+                        func(shard.mixer);
+                }
+                /**
+                 * @brief Build the pairs from given tracks and sort them into groups. For at least GetParallelThreshold() tracks the work is split between the threads of the pool.
+                 *
+                 * @param tracks tracks vector
+                 * @param layout partners and parities of the tracks, empty for the tracks of a single event
+                 * @return PairMap sorted pairs
+                 */
+                [[nodiscard]] PairMap MakeSortedPairs(const std::vector<std::shared_ptr<Track> > &tracks, const typename Mixer::TrackLayout &layout = {}) const;
+                /**
+                 * @brief Remove the least recently filled event classes of all shards until the memory usage fits in the memory budget. The shards are locked one at a time.
+                 *
+                 */
+                void EnforceMemoryBudget();
+                /**
+                 * @brief Sum up the memory usage of all shards and enforce the memory budget. Called after the settings which change the memory taken by the classes.
+                 *
+                 */
+                void RecountMemoryUsage();
+
+            public:
+                /**
+                 * @brief Create the mixer. Default settings are the same as for JJFemtoMixer, except for the seed, which is 0.
+                 *
+                 * @param nShards Number of independently locked parts of the mixing buffers.
+                 * @param nThreads Number of threads used to build the pairs of a single large event (including the calling thread).
+                 */
+                explicit JJFemtoMixerConcurrent(std::size_t nShards = 64, std::size_t nThreads = std::thread::hardware_concurrency())
+                    : m_shards((nShards > 0) ? nShards : 1),
+                      m_parallelThreshold(1000),
+                      m_taskPool(std::make_unique<JJUtils::TaskPool>(nThreads)),
+                      m_fillClock(0),
+                      m_memoryUsage(0),
+                      m_evictedClasses(0)
+                {
+                    // the tracks of the background events are paired outside of the shard lock, so a buffer entry must never be refilled in place
+                    for (auto &shard : m_shards)
+                        shard.mixer.m_reuseTrackStorage = false;
+
+                    SetSeed(0);
+                }
+
+                /**
+                 * @brief Set the Event Hashing Function object.
+                 *
+                 * @param func Function object, can be lambda, standard function or std::function object.
+                 */
+                void SetEventHashingFunction(const std::function<EventKey(const std::shared_ptr<Event> &)> &func) {ForEachMixer([&func](Mixer &mixer){mixer.SetEventHashingFunction(func);});}
+                /**
+                 * @brief Set the Pair Hashing Function object.
+                 *
+                 * @param func Function object, can be lambda, standard function or std::function object.
+                 */
+                void SetPairHashingFunction(const std::function<PairKey(const std::shared_ptr<Pair> &)> &func) {ForEachMixer([&func](Mixer &mixer){mixer.SetPairHashingFunction(func);});}
+                /**
+                 * @brief Set the Pair Cutting Function object. The function should return true if pair should be rejected and false if accepted.
+                 *
+                 * @param func Function object, can be lambda, standard function or std::function object.
+                 */
+                void SetPairCuttingFunction(const std::function<bool(const std::shared_ptr<Pair> &)> &func) {ForEachMixer([&func](Mixer &mixer){mixer.SetPairCuttingFunction(func);});}
+                /**
+                 * @brief Set the pair pre-cut (see JJFemtoMixer::SetPairPreCut).
+                 *
+                 * @param preCut Pre-cut values.
+                 */
+                void SetPairPreCut(const JJPairPreCut &preCut) {ForEachMixer([&preCut](Mixer &mixer){mixer.SetPairPreCut(preCut);});}
+                /**
+                 * @brief Set the max mixing buffer size for each "branch".
+                 *
+                 * @param buffer Max buffer size.
+                 */
+                void SetMaxBufferSize(std::size_t buffer)
+                {
+                    ForEachMixer([buffer](Mixer &mixer){mixer.SetMaxBufferSize(buffer);});
+                    RecountMemoryUsage();
+                }
+                /**
+                 * @brief Get the max mixing buffer size.
+                 *
+                 * @return std::size_t Max buffer size.
+                 */
+                [[nodiscard]] std::size_t GetMaxBufferSize() const noexcept {return m_prototype.GetMaxBufferSize();}
+                /**
+                 * @brief Define whether mixing should occur only for "branches" with size equal to the max buffer size.
+                 *
+                 * @param fixBuffer Buffer size usage flag.
+                 */
+                void FixBuffer(bool fixBuffer) {ForEachMixer([fixBuffer](Mixer &mixer){mixer.FixBuffer(fixBuffer);});}
+                /**
+                 * @brief Get the mixing buffer flag.
+                 *
+                 * @return true - Mixing with fixed size.
+                 * @return false - Mixnig with any size.
+                 */
+                [[nodiscard]] bool GetBufferState() const noexcept {return m_prototype.GetBufferState();}
+                /**
+                 * @brief Set the seed of the random number generators. Each event class gets its own generator seeded from this seed and the class key (see JJFemtoMixer::SetSeed),
+                 * so the selection of tracks is reproducible for given seed and order of events within each event class, whatever the number of shards and the order of events from different classes.
+                 *
+                 * @param seed Seed value.
+                 */
+                void SetSeed(std::uint_fast32_t seed) {ForEachMixer([seed](Mixer &mixer){mixer.SetSeed(seed);});}
+                /**
+                 * @brief Get the seed of the random number generators.
+                 *
+                 * @return std::uint_fast32_t
+                 */
+                [[nodiscard]] std::uint_fast32_t GetSeed() const noexcept {return m_prototype.GetSeed();}
+                /**
+                 * @brief Enable or disable the background pair cache of each shard (see JJFemtoMixer::SetBackgroundPairCaching). With the cache enabled the background pairs are collected under the shard lock.
+                 *
+                 * @param cache Set true to enable the cache.
+                 */
+                void SetBackgroundPairCaching(bool cache)
+                {
+                    ForEachMixer([cache](Mixer &mixer){mixer.SetBackgroundPairCaching(cache);});
+                    RecountMemoryUsage();
+                }
+                /**
+                 * @brief Get the background pair cache flag.
+                 *
+                 * @return true - Background pairs are cached.
+                 * @return false - Background pairs are built on each call.
+                 */
+                [[nodiscard]] bool GetBackgroundPairCaching() const noexcept {return m_prototype.GetBackgroundPairCaching();}
+                /**
+                 * @brief Set the number of tracks stored in the mixing buffer for each event (see JJFemtoMixer::SetTracksPerEvent).
+                 *
+                 * @param nTracks Number of tracks, at least 1.
+                 */
+                void SetTracksPerEvent(std::size_t nTracks)
+                {
+                    ForEachMixer([nTracks](Mixer &mixer){mixer.SetTracksPerEvent(nTracks);});
+                    RecountMemoryUsage();
+                }
+                /**
+                 * @brief Get the number of tracks stored in the mixing buffer for each event.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetTracksPerEvent() const noexcept {return m_prototype.GetTracksPerEvent();}
+                /**
+                 * @brief Set the memory budget of the mixing buffers and the background pair cache (see JJFemtoMixer::SetMemoryBudget). One budget is shared by all shards:
+                 * when an event makes the total usage exceed it, the classes which did not receive events for the longest time are removed, whichever shard they belong to.
+                 *
+                 * @param bytes Budget in bytes, 0 for no limit.
+                 */
+                void SetMemoryBudget(std::size_t bytes)
+                {
+                    m_prototype.SetMemoryBudget(bytes);
+                    RecountMemoryUsage();
+                }
+                /**
+                 * @brief Get the memory budget of the mixing buffers and the background pair cache.
+                 *
+                 * @return std::size_t Budget in bytes, 0 means no limit.
+                 */
+                [[nodiscard]] std::size_t GetMemoryBudget() const noexcept {return m_prototype.GetMemoryBudget();}
+                /**
+                 * @brief Get the estimated memory taken by the mixing buffers and the background pair cache of all shards.
+                 *
+                 * @return std::size_t Bytes.
+                 */
+                [[nodiscard]] std::size_t GetMemoryUsage() const noexcept {return m_memoryUsage.load();}
+                /**
+                 * @brief Get the number of event classes removed so far to stay within the memory budget.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetNEvictedClasses() const noexcept {return m_evictedClasses.load();}
+                /**
+                 * @brief Set the minimal number of tracks for which the pairs are built in parallel.
+                 *
+                 * @param nTracks Number of tracks.
+                 */
+                void SetParallelThreshold(std::size_t nTracks) noexcept {m_parallelThreshold = nTracks;}
+                /**
+                 * @brief Get the minimal number of tracks for which the pairs are built in parallel.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetParallelThreshold() const noexcept {return m_parallelThreshold;}
+                /**
+                 * @brief Get the number of shards.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetNShards() const noexcept {return m_shards.size();}
+                /**
+                 * @brief Get the number of threads used to build the pairs of a single large event.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetNThreads() const noexcept {return m_taskPool->GetNThreads();}
+                /**
+                 * @brief Prints to the standard output information about current setup of JJFemtoMixerConcurrent.
+                 *
+                 */
+                void PrintSettings() const;
+                /**
+                 * @brief Prints to the standard output information about the amounts of tracks and events currently stored in JJFemtoMixerConcurrent. Locks each shard while printing it.
+                 *
+                 */
+                void PrintStatus();
+                /**
+                 * @brief Write the mixing buffers of all shards to a binary snapshot (see JJFemtoMixer::SaveBuffers). Locks each shard while saving it.
+                 *
+                 * @param stream output stream (opened in binary mode)
+                 */
+                void SaveBuffers(std::ostream &stream);
+                /**
+                 * @brief Write the mixing buffers of all shards to a binary snapshot file.
+                 *
+                 * @param fileName path to the file, overwritten if it exists
+                 */
+                void SaveBuffers(const std::string &fileName);
+                /**
+                 * @brief Replace the mixing buffers with the content of a snapshot (see JJFemtoMixer::LoadBuffers). Each event class goes to the shard responsible for it, so the snapshot does not depend on the number of shards.
+                 * Call it before the threads start adding events.
+                 *
+                 * @param snapshot snapshot view
+                 */
+                void LoadBuffers(const JJBufferSnapshotView &snapshot);
+                /**
+                 * @brief Replace the mixing buffers with the content of a snapshot file.
+                 *
+                 * @param fileName path to the file
+                 */
+                void LoadBuffers(const std::string &fileName);
+                /**
+                 * @brief Add currently processed event to the mixer. Thread-safe.
+                 *
+                 * @param event Current event.
+                 * @param tracks Tracks from the current event.
+                 * @return PairMap Sorted pairs from provided tracks for given event.
+                 */
+                PairMap AddEvent(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks);
+                /**
+                 * @brief Get the sorted pairs which come from similar events, but not from this event. Thread-safe.
+                 *
+                 * @param event Current event (the event from which we don't want to get tracks).
+                 * @return PairMap Sorted pairs from stored tracks for similar events.
+                 */
+                [[nodiscard]] PairMap GetSimilarPairs(const std::shared_ptr<Event> &event);
+        };
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::SaveBuffers(std::ostream &stream)
+        {
+            JJBufferSnapshotWriter<Track,EventKey> writer(m_prototype.GetMaxBufferSize());
+            for (auto &shard : m_shards)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                shard.mixer.AddBuffersToSnapshot(writer);
+            }
+
+            writer.Write(stream);
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::SaveBuffers(const std::string &fileName)
+        {
+            std::ofstream file(fileName,std::ios::binary | std::ios::trunc);
+            if (! file)
+                throw std::runtime_error("JJBufferSnapshot: cannot open " + fileName);
+
+            SaveBuffers(file);
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::LoadBuffers(const JJBufferSnapshotView &snapshot)
+        {
+            static_assert(Detail::HasTrackSerializer<Track>::value,"Mixing::TrackSerializer has to be specialised for the track type to load the mixing buffers!");
+            if (snapshot.GetTrackSize() != TrackSerializer<Track>::Size)
+                throw std::runtime_error("JJBufferSnapshot: track record size does not match the track serializer");
+            snapshot.CheckKeyType<EventKey>();
+
+            std::vector<EventKey> keys;
+            keys.reserve(snapshot.GetNClasses());
+            for (std::size_t evtClass = 0; evtClass < snapshot.GetNClasses(); ++evtClass)
+                keys.push_back(Detail::KeyCodec<EventKey>::Decode(snapshot.GetClassKey(evtClass)));
+
+            for (auto &shard : m_shards)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                shard.mixer.ClearBuffers();
+            }
+
+            for (std::size_t evtClass = 0; evtClass < keys.size(); ++evtClass)
+            {
+                Shard &shard = GetShard(keys[evtClass]);
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                shard.mixer.m_fillClock = m_fillClock.fetch_add(1);
+                shard.mixer.LoadBufferClass(snapshot,evtClass,keys[evtClass]);
+            }
+
+            for (auto &shard : m_shards)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                shard.mixer.RebuildPairCache();
+            }
+
+            RecountMemoryUsage();
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::LoadBuffers(const std::string &fileName)
+        {
+            const std::vector<unsigned char> data = Detail::ReadSnapshotFile(fileName);
+            LoadBuffers(JJBufferSnapshotView(data.data(),data.size()));
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        typename JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::PairMap JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::MakeSortedPairs(const std::vector<std::shared_ptr<Track> > &tracks, const typename Mixer::TrackLayout &layout) const
+        {
+            const std::size_t trckSize = tracks.size();
+            if (trckSize < m_parallelThreshold || m_taskPool->GetNThreads() < 2)
+                return m_prototype.SortPairs(m_prototype.MakePairs(tracks,layout));
+
+            // rows of the pair triangle are grouped into chunks of roughly equal number of pairs, several chunks per thread so that the faster threads can take over the rest
+            const std::vector<std::size_t> &partnerBegin = layout.partnerBegin;
+            const std::size_t nPairs = Mixer::CountCombinations(trckSize,partnerBegin,0,trckSize);
+            const std::size_t nChunks = 4 * m_taskPool->GetNThreads();
+            std::vector<std::size_t> chunkRows(1,0);
+            for (std::size_t row = 0, pairsSoFar = 0; row < trckSize; ++row)
+            {
+                pairsSoFar += trckSize - ((partnerBegin.empty()) ? row + 1 : partnerBegin[row]);
+                if (pairsSoFar * nChunks >= nPairs * chunkRows.size() || row + 1 == trckSize)
+                    chunkRows.push_back(row + 1);
+            }
+
+            // the tracks are converted to the structure-of-arrays layout once and shared by all chunks
+            JJTrackSoA soa;
+            if constexpr (Detail::HasTrackKinematics<Track>::value)
+            {
+                if (m_prototype.UsesPairPreCut())
+                    soa.Assign(tracks);
+            }
+            const JJTrackSoA *soaPtr = (m_prototype.UsesPairPreCut()) ? &soa : nullptr;
+
+            std::vector<PairMap> chunkMaps(chunkRows.size() - 1);
+            m_taskPool->ParallelFor(chunkMaps.size(),[this,&tracks,&layout,&chunkRows,&chunkMaps,soaPtr](std::size_t chunk)
+            {
+                PairMap &pairMap = chunkMaps[chunk];
+                m_prototype.ForEachTrackCombinationInRows(tracks,layout,soaPtr,chunkRows[chunk],chunkRows[chunk + 1],[this,&pairMap](const std::shared_ptr<Track> &trck1, const std::shared_ptr<Track> &trck2)
+                {
+                    auto pair = std::make_shared<Pair>(trck1,trck2);
+                    pairMap[m_prototype.ClassifyPair(pair)].push_back(std::move(pair));
+                });
+            });
+
+            // merging in the chunk order keeps the result identical to the serial one
+            PairMap pairMap = std::move(chunkMaps.front());
+            for (std::size_t chunk = 1; chunk < chunkMaps.size(); ++chunk)
+                for (auto &[key,pairs] : chunkMaps[chunk])
+                {
+                    auto &bucket = pairMap[key];
+                    bucket.insert(bucket.end(),std::make_move_iterator(pairs.begin()),std::make_move_iterator(pairs.end()));
+                }
+
+            return pairMap;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::EnforceMemoryBudget()
+        {
+            const std::size_t budget = m_prototype.GetMemoryBudget();
+            if (budget == 0 || m_memoryUsage.load() <= budget)
+                return;
+
+            std::lock_guard<std::mutex> evictionLock(m_evictionMutex);
+            while (m_memoryUsage.load() > budget)
+            {
+                // find the least recently filled class of all shards, the most recently filled one is always kept
+                Shard *oldestShard = nullptr;
+                std::uint64_t oldestFill = 0;
+                std::size_t nClasses = 0;
+                for (auto &shard : m_shards)
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    nClasses += shard.mixer.m_similarityMap.size();
+                    const auto *classBuffer = shard.mixer.GetLeastRecentClass();
+                    if (classBuffer != nullptr && (oldestShard == nullptr || classBuffer->lastFilled < oldestFill))
+                    {
+                        oldestShard = &shard;
+                        oldestFill = classBuffer->lastFilled;
+                    }
+                }
+
+                if (nClasses <= 1)
+                    return;
+
+                std::lock_guard<std::mutex> lock(oldestShard->mutex);
+                // the class may have received an event after the scan, then the search is repeated
+                const auto *classBuffer = oldestShard->mixer.GetLeastRecentClass();
+                if (classBuffer == nullptr || classBuffer->lastFilled != oldestFill)
+                    continue;
+
+                const std::size_t usageBefore = oldestShard->mixer.GetMemoryUsage();
+                oldestShard->mixer.EvictLeastRecentClass();
+                m_memoryUsage.fetch_sub(usageBefore - oldestShard->mixer.GetMemoryUsage());
+                m_evictedClasses.fetch_add(1);
+            }
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::RecountMemoryUsage()
+        {
+            std::size_t usage = 0;
+            for (auto &shard : m_shards)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                usage += shard.mixer.GetMemoryUsage();
+            }
+
+            m_memoryUsage = usage;
+            EnforceMemoryBudget();
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::PrintSettings() const
+        {
+            m_prototype.PrintSettings();
+            std::cout << "------============= JJFemtoMixerConcurrent Setup ==========------\n";
+            std::cout << "Shards: " << m_shards.size() << "\n";
+            std::cout << "Threads: " << m_taskPool->GetNThreads() << " (parallel pair building from " << m_parallelThreshold << " tracks)\n";
+            std::cout << "Seed: " << GetSeed() << "\n";
+            std::cout << "------=====================================================------\n" << std::endl;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        void JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::PrintStatus()
+        {
+            std::cout << "\n------================ JJFemtoMixer Status ================------\n";
+            std::cout << "Stored events / total\tevent hash\ttimes poped\n";
+            for (auto &shard : m_shards)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                for (const auto &[key,val] : shard.mixer.m_similarityMap)
+                {
+                    std::cout << "\t" << val.ring.size() << "/" << GetMaxBufferSize() << "\t\t" << key << "\t\t" << val.popCounter << "\n";
+                }
+            }
+            std::cout << "Buffer memory (estimate): " << GetMemoryUsage() << " B / " << ((GetMemoryBudget() > 0) ? std::to_string(GetMemoryBudget()) + " B" : std::string("unlimited")) << "\tevicted classes: " << GetNEvictedClasses() << "\n";
+
+            std::cout << "------=====================================================------\n" << std::endl;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        typename JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::PairMap JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::AddEvent(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks)
+        {
+            Shard &shard = GetShard(m_prototype.GetEventHash(event));
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                // the shard mixers have no budget of their own, the change of their usage is added to the shared one (unsigned arithmetic, so a shrinking buffer works too)
+                const std::size_t usageBefore = shard.mixer.GetMemoryUsage();
+                shard.mixer.m_fillClock = m_fillClock.fetch_add(1);
+                shard.mixer.StoreEvent(event,tracks);
+                m_memoryUsage.fetch_add(shard.mixer.GetMemoryUsage() - usageBefore);
+            }
+
+            EnforceMemoryBudget();
+
+            // the pairs are built outside of the lock
+            return MakeSortedPairs(tracks);
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventKey, typename PairKey>
+        typename JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::PairMap JJFemtoMixerConcurrent<Event,Track,Pair,EventKey,PairKey>::GetSimilarPairs(const std::shared_ptr<Event> &event)
+        {
+            typename Mixer::SimilarTracks similarTracks;
+            Shard &shard = GetShard(m_prototype.GetEventHash(event));
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                // the cached pairs only have to be collected, which is cheap enough to do under the lock
+                if (shard.mixer.GetBackgroundPairCaching())
+                    return shard.mixer.GetSimilarPairs(event);
+
+                similarTracks = shard.mixer.GetSimilarTracks(event);
+            }
+
+            return MakeSortedPairs(similarTracks.tracks,similarTracks.layout);
+        }
+    } // namespace Mixing
+
+#endif
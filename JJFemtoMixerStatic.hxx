@@ -0,0 +1,426 @@
+/**
+ * @file JJFemtoMixerStatic.hxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Mixer with the hashing and cut functions given as template parameters
+ * @version 1.0
+ * @date 2024-12-12
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef JJFemtoMixerStatic_hxx
+    #define JJFemtoMixerStatic_hxx
+
+    #include <vector>
+    #include <memory>
+    #include <string>
+    #include <cstdint>
+    #include <type_traits>
+    #include "JJFemtoMixer.hxx"
+
+    namespace Mixing
+    {
+        /**
+         * @brief Event hashing policy which puts all events into a single class.
+         *
+         */
+        struct NoEventHashing
+        {
+            template<typename Event>
+            constexpr std::uint32_t operator()(const Event &) const noexcept {return 0;}
+        };
+
+        /**
+         * @brief Pair hashing policy which puts all pairs into a single group.
+         *
+         */
+        struct NoPairHashing
+        {
+            template<typename Pair>
+            constexpr std::uint32_t operator()(const Pair &) const noexcept {return 0;}
+        };
+
+        /**
+         * @brief Pair cut policy which accepts all pairs.
+         *
+         */
+        struct NoPairCut
+        {
+            template<typename Pair>
+            constexpr bool operator()(const Pair &) const noexcept {return false;}
+        };
+
+        namespace Detail
+        {
+            /**
+             * @brief Result type of calling a policy with given argument, or void if the policy cannot be called with it
+             *
+             */
+            template<typename Policy, typename Arg, typename Enable = void>
+            struct PolicyResult
+            {
+                using type = void;
+            };
+
+            template<typename Policy, typename Arg>
+            struct PolicyResult<Policy, Arg, std::void_t<std::invoke_result_t<const Policy&, const Arg&> > >
+            {
+                using type = std::decay_t<std::invoke_result_t<const Policy&, const Arg&> >;
+            };
+        }
+
+        /**
+         * @brief Variant of JJFemtoMixer whose event hashing, pair hashing and pair cut are template parameters (policies) instead of std::function members.
+         * The per-pair calls can be inlined by the compiler, and the cut or the pair grouping disappears at compile time when NoPairCut or NoPairHashing is used.
+         * JJFemtoMixer stays the runtime-configurable option. Use MakeStaticMixer() to deduce the policy types from lambdas.
+         *
+         * @tparam Event event type
+         * @tparam Track track type
+         * @tparam Pair pair type
+         * @tparam EventHashing callable with signature EventKey(const Event &)
+         * @tparam PairHashing callable with signature PairKey(const Pair &)
+         * @tparam PairCut callable with signature bool(const Pair &), returning true if the pair should be rejected
+         */
+        template<typename Event, typename Track, typename Pair, typename EventHashing = NoEventHashing, typename PairHashing = NoPairHashing, typename PairCut = NoPairCut>
+        class JJFemtoMixerStatic
+        {
+            static_assert(! std::is_void<typename Detail::PolicyResult<EventHashing,Event>::type>::value,"Provided event hashing policy is not callable with (const Event &)!");
+            static_assert(! std::is_void<typename Detail::PolicyResult<PairHashing,Pair>::type>::value,"Provided pair hashing policy is not callable with (const Pair &)!");
+            static_assert(std::is_invocable_r<bool, const PairCut&, const Pair&>::value,"Provided pair cut policy is not callable with (const Pair &) or does not return bool!");
+
+            public:
+                using EventKey = typename Detail::PolicyResult<EventHashing,Event>::type;
+                using PairKey = typename Detail::PolicyResult<PairHashing,Pair>::type;
+                using Mixer = JJFemtoMixer<Event,Track,Pair,EventKey,PairKey>;
+                using PairMap = typename Mixer::PairMap;
+
+            private:
+                static constexpr bool s_hasPairHashing = ! std::is_same<PairHashing,NoPairHashing>::value;
+                static constexpr bool s_hasPairCut = ! std::is_same<PairCut,NoPairCut>::value;
+
+                EventHashing m_eventHashing;
+                PairHashing m_pairHashing;
+                PairCut m_pairCut;
+                Mixer m_store; // holds the mixing buffers, called once per event
+
+                /**
+                 * @brief Get the group of the pair, resolved at compile time when no cut or no grouping is used
+                 *
+                 * @param pair pair object
+                 * @return PairKey
+                 */
+                [[nodiscard]] PairKey ClassifyPair(const Pair &pair) const
+                {
+                    if constexpr (s_hasPairCut)
+                    {
+                        if (m_pairCut(pair))
+                            return KeyTraits<PairKey>::Bad();
+                    }
+
+                    if constexpr (s_hasPairHashing)
+                        return m_pairHashing(pair);
+                    else
+                        return KeyTraits<PairKey>::Default();
+                }
+                /**
+                 * @brief Build the pairs from given tracks and sort them into groups
+                 *
+                 * @param tracks tracks vector
+                 * @param layout partners and parities of the tracks, empty for the tracks of a single event
+                 * @return PairMap sorted pairs
+                 */
+                [[nodiscard]] PairMap MakeSortedPairs(const std::vector<std::shared_ptr<Track> > &tracks, const typename Mixer::TrackLayout &layout = {}) const;
+                /**
+                 * @brief Build each pair from given tracks on the stack, classify it and pass it straight to the visitor
+                 *
+                 * @tparam Visitor callable with signature void(const PairKey &, const Pair &)
+                 * @param tracks tracks vector
+                 * @param visitor function called for each pair
+                 * @param layout partners and parities of the tracks, empty for the tracks of a single event
+                 */
+                template<typename Visitor>
+                void VisitPairs(const std::vector<std::shared_ptr<Track> > &tracks, Visitor &&visitor, const typename Mixer::TrackLayout &layout = {}) const;
+
+            public:
+                /**
+                 * @brief Create the mixer from the policy objects. Default settings are the same as for JJFemtoMixer.
+                 *
+                 * @param eventHashing Event hashing policy.
+                 * @param pairHashing Pair hashing policy.
+                 * @param pairCut Pair cut policy.
+                 */
+                explicit JJFemtoMixerStatic(EventHashing eventHashing = EventHashing(), PairHashing pairHashing = PairHashing(), PairCut pairCut = PairCut())
+                    : m_eventHashing(std::move(eventHashing)),
+                      m_pairHashing(std::move(pairHashing)),
+                      m_pairCut(std::move(pairCut))
+                {
+                    // the buffers are only touched once per event, so the std::function indirection is harmless there
+                    if constexpr (! std::is_same<EventHashing,NoEventHashing>::value)
+                        m_store.SetEventHashingFunction([hashing = m_eventHashing](const std::shared_ptr<Event> &event){return hashing(*event);});
+                    // used only by the background pair cache
+                    if constexpr (s_hasPairHashing)
+                        m_store.SetPairHashingFunction([hashing = m_pairHashing](const std::shared_ptr<Pair> &pair){return hashing(*pair);});
+                    if constexpr (s_hasPairCut)
+                        m_store.SetPairCuttingFunction([cut = m_pairCut](const std::shared_ptr<Pair> &pair){return cut(*pair);});
+                }
+
+                /**
+                 * @brief Get the corresponding hash for given Event object.
+                 *
+                 * @param obj Event-type object
+                 * @return EventKey
+                 */
+                [[nodiscard]] EventKey GetEventHash(const std::shared_ptr<Event> &obj) const {return m_eventHashing(*obj);}
+                /**
+                 * @brief Get the group of given Pair object, i.e. KeyTraits<PairKey>::Bad() if it is rejected by the cut or the pair hash otherwise.
+                 *
+                 * @param obj Pair-type object.
+                 * @return PairKey
+                 */
+                [[nodiscard]] PairKey GetPairGroup(const Pair &obj) const {return ClassifyPair(obj);}
+                /**
+                 * @brief Set the pair pre-cut (see JJFemtoMixer::SetPairPreCut).
+                 *
+                 * @param preCut Pre-cut values.
+                 */
+                void SetPairPreCut(const JJPairPreCut &preCut) noexcept {m_store.SetPairPreCut(preCut);}
+                /**
+                 * @brief Set the max mixing buffer size for each "branch".
+                 *
+                 * @param buffer Max buffer size.
+                 */
+                void SetMaxBufferSize(std::size_t buffer) {m_store.SetMaxBufferSize(buffer);}
+                /**
+                 * @brief Get the max mixing buffer size.
+                 *
+                 * @return std::size_t Max buffer size.
+                 */
+                [[nodiscard]] std::size_t GetMaxBufferSize() const noexcept {return m_store.GetMaxBufferSize();}
+                /**
+                 * @brief Define whether mixing should occur only for "branches" with size equal to the max buffer size.
+                 *
+                 * @param fixBuffer Buffer size usage flag.
+                 */
+                void FixBuffer(bool fixBuffer) noexcept {m_store.FixBuffer(fixBuffer);}
+                /**
+                 * @brief Get the mixing buffer flag.
+                 *
+                 * @return true - Mixing with fixed size.
+                 * @return false - Mixnig with any size.
+                 */
+                [[nodiscard]] bool GetBufferState() const noexcept {return m_store.GetBufferState();}
+                /**
+                 * @brief Set the seed of the random number generators used to select the tracks stored in the mixing buffer (see JJFemtoMixer::SetSeed).
+                 *
+                 * @param seed Seed value.
+                 */
+                void SetSeed(std::uint_fast32_t seed) {m_store.SetSeed(seed);}
+                /**
+                 * @brief Enable or disable the background pair cache (see JJFemtoMixer::SetBackgroundPairCaching).
+                 *
+                 * @param cache Set true to enable the cache.
+                 */
+                void SetBackgroundPairCaching(bool cache) {m_store.SetBackgroundPairCaching(cache);}
+                /**
+                 * @brief Get the background pair cache flag.
+                 *
+                 * @return true - Background pairs are cached.
+                 * @return false - Background pairs are built on each call.
+                 */
+                [[nodiscard]] bool GetBackgroundPairCaching() const noexcept {return m_store.GetBackgroundPairCaching();}
+                /**
+                 * @brief Set the number of tracks stored in the mixing buffer for each event (see JJFemtoMixer::SetTracksPerEvent).
+                 *
+                 * @param nTracks Number of tracks, at least 1.
+                 */
+                void SetTracksPerEvent(std::size_t nTracks) {m_store.SetTracksPerEvent(nTracks);}
+                /**
+                 * @brief Get the number of tracks stored in the mixing buffer for each event.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetTracksPerEvent() const noexcept {return m_store.GetTracksPerEvent();}
+                /**
+                 * @brief Set the memory budget of the mixing buffers (see JJFemtoMixer::SetMemoryBudget).
+                 *
+                 * @param bytes Budget in bytes, 0 for no limit.
+                 */
+                void SetMemoryBudget(std::size_t bytes) {m_store.SetMemoryBudget(bytes);}
+                /**
+                 * @brief Get the memory budget of the mixing buffers.
+                 *
+                 * @return std::size_t Budget in bytes, 0 means no limit.
+                 */
+                [[nodiscard]] std::size_t GetMemoryBudget() const noexcept {return m_store.GetMemoryBudget();}
+                /**
+                 * @brief Get the estimated memory taken by the mixing buffers.
+                 *
+                 * @return std::size_t Bytes.
+                 */
+                [[nodiscard]] std::size_t GetMemoryUsage() const noexcept {return m_store.GetMemoryUsage();}
+                /**
+                 * @brief Prints to the standard output information about current setup of JJFemtoMixerStatic.
+                 *
+                 */
+                void PrintSettings() const noexcept {m_store.PrintSettings();}
+                /**
+                 * @brief Prints to the standard output information about the amounts of tracks and events currently stored in JJFemtoMixerStatic.
+                 *
+                 */
+                void PrintStatus() const noexcept {m_store.PrintStatus();}
+                /**
+                 * @brief Write the mixing buffers to a binary snapshot (see JJFemtoMixer::SaveBuffers).
+                 *
+                 * @param stream output stream (opened in binary mode)
+                 */
+                void SaveBuffers(std::ostream &stream) const {m_store.SaveBuffers(stream);}
+                /**
+                 * @brief Write the mixing buffers to a binary snapshot file.
+                 *
+                 * @param fileName path to the file, overwritten if it exists
+                 */
+                void SaveBuffers(const std::string &fileName) const {m_store.SaveBuffers(fileName);}
+                /**
+                 * @brief Replace the mixing buffers with the content of a snapshot (see JJFemtoMixer::LoadBuffers).
+                 *
+                 * @param snapshot snapshot view
+                 */
+                void LoadBuffers(const JJBufferSnapshotView &snapshot) {m_store.LoadBuffers(snapshot);}
+                /**
+                 * @brief Replace the mixing buffers with the content of a snapshot file.
+                 *
+                 * @param fileName path to the file
+                 */
+                void LoadBuffers(const std::string &fileName) {m_store.LoadBuffers(fileName);}
+                /**
+                 * @brief Add currently processed event to the mixer.
+                 *
+                 * @param event Current event.
+                 * @param tracks Tracks from the current event.
+                 * @return PairMap Sorted pairs from provided tracks for given event.
+                 */
+                PairMap AddEvent(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks);
+                /**
+                 * @brief Get the sorted pairs which come from similar events, but not from this event.
+                 *
+                 * @param event Current event (the event from which we don't want to get tracks).
+                 * @return PairMap Sorted pairs from stored tracks for similar events.
+                 */
+                [[nodiscard]] PairMap GetSimilarPairs(const std::shared_ptr<Event> &event) const;
+                /**
+                 * @brief Add currently processed event to the mixer and pass each of its pairs, together with its group, to the visitor (see JJFemtoMixer::ForEachSignalPair).
+                 *
+                 * @tparam Visitor callable with signature void(const PairKey &, const Pair &)
+                 * @param event Current event.
+                 * @param tracks Tracks from the current event.
+                 * @param visitor Function called for each pair.
+                 */
+                template<typename Visitor>
+                void ForEachSignalPair(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks, Visitor &&visitor);
+                /**
+                 * @brief Pass each pair which comes from similar events, but not from this event, together with its group, to the visitor (see JJFemtoMixer::ForEachBackgroundPair).
+                 *
+                 * @tparam Visitor callable with signature void(const PairKey &, const Pair &)
+                 * @param event Current event (the event from which we don't want to get tracks).
+                 * @param visitor Function called for each pair.
+                 */
+                template<typename Visitor>
+                void ForEachBackgroundPair(const std::shared_ptr<Event> &event, Visitor &&visitor) const;
+        };
+
+        /**
+         * @brief Create JJFemtoMixerStatic deducing the policy types, e.g. from lambdas.
+         *
+         * @tparam Event event type
+         * @tparam Track track type
+         * @tparam Pair pair type
+         * @param eventHashing Event hashing policy.
+         * @param pairHashing Pair hashing policy.
+         * @param pairCut Pair cut policy.
+         * @return JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut>
+         */
+        template<typename Event, typename Track, typename Pair, typename EventHashing = NoEventHashing, typename PairHashing = NoPairHashing, typename PairCut = NoPairCut>
+        [[nodiscard]] JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut> MakeStaticMixer(EventHashing eventHashing = EventHashing(), PairHashing pairHashing = PairHashing(), PairCut pairCut = PairCut())
+        {
+            return JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut>(std::move(eventHashing),std::move(pairHashing),std::move(pairCut));
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventHashing, typename PairHashing, typename PairCut>
+        typename JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut>::PairMap JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut>::MakeSortedPairs(const std::vector<std::shared_ptr<Track> > &tracks, const typename Mixer::TrackLayout &layout) const
+        {
+            PairMap pairMap;
+
+            if constexpr (! s_hasPairHashing && ! s_hasPairCut)
+            {
+                // every pair belongs to the same group, no classification needed
+                auto pairs = m_store.MakePairs(tracks,layout);
+                if (! pairs.empty())
+                    pairMap.emplace(KeyTraits<PairKey>::Default(),std::move(pairs));
+            }
+            else
+            {
+                m_store.ForEachTrackCombination(tracks,layout,[this,&pairMap](const std::shared_ptr<Track> &trck1, const std::shared_ptr<Track> &trck2)
+                {
+                    auto pair = std::make_shared<Pair>(trck1,trck2);
+                    pairMap[ClassifyPair(*pair)].push_back(std::move(pair));
+                });
+            }
+
+            return pairMap;
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventHashing, typename PairHashing, typename PairCut>
+        template<typename Visitor>
+        void JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut>::VisitPairs(const std::vector<std::shared_ptr<Track> > &tracks, Visitor &&visitor, const typename Mixer::TrackLayout &layout) const
+        {
+            static_assert(std::is_invocable<Visitor&,const PairKey&,const Pair&>::value,"Provided visitor is not callable with (const PairKey &, const Pair &)!");
+
+            m_store.ForEachTrackCombination(tracks,layout,[this,&visitor](const std::shared_ptr<Track> &trck1, const std::shared_ptr<Track> &trck2)
+            {
+                const Pair pair(trck1,trck2);
+                visitor(ClassifyPair(pair),pair);
+            });
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventHashing, typename PairHashing, typename PairCut>
+        typename JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut>::PairMap JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut>::AddEvent(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks)
+        {
+            m_store.StoreEvent(event,tracks);
+
+            return MakeSortedPairs(tracks);
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventHashing, typename PairHashing, typename PairCut>
+        typename JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut>::PairMap JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut>::GetSimilarPairs(const std::shared_ptr<Event> &event) const
+        {
+            if (m_store.GetBackgroundPairCaching())
+                return m_store.GetSimilarPairs(event);
+
+            const auto similar = m_store.GetSimilarTracks(event);
+            return MakeSortedPairs(similar.tracks,similar.layout);
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventHashing, typename PairHashing, typename PairCut>
+        template<typename Visitor>
+        void JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut>::ForEachSignalPair(const std::shared_ptr<Event> &event, const std::vector<std::shared_ptr<Track> > &tracks, Visitor &&visitor)
+        {
+            m_store.StoreEvent(event,tracks);
+            VisitPairs(tracks,std::forward<Visitor>(visitor));
+        }
+
+        template<typename Event, typename Track, typename Pair, typename EventHashing, typename PairHashing, typename PairCut>
+        template<typename Visitor>
+        void JJFemtoMixerStatic<Event,Track,Pair,EventHashing,PairHashing,PairCut>::ForEachBackgroundPair(const std::shared_ptr<Event> &event, Visitor &&visitor) const
+        {
+            if (m_store.GetBackgroundPairCaching())
+                m_store.ForEachBackgroundPair(event,std::forward<Visitor>(visitor));
+            else
+            {
+                const auto similar = m_store.GetSimilarTracks(event);
+                VisitPairs(similar.tracks,std::forward<Visitor>(visitor),similar.layout);
+            }
+        }
+    } // namespace Mixing
+
+#endif
@@ -0,0 +1,329 @@
+/**
+ * @file JJFlatHashMap.hxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Flat, open-addressing hash map used for the typed-key mode of the mixer
+ * @version 1.0
+ * @date 2024-12-02
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef JJFlatHashMap_hxx
+    #define JJFlatHashMap_hxx
+
+    #include <vector>
+    #include <utility>
+    #include <tuple>
+    #include <iterator>
+    #include <algorithm>
+    #include <functional>
+    #include <stdexcept>
+    #include <cstdint>
+    #include <cstddef>
+
+    namespace JJUtils
+    {
+        /**
+         * @brief Associative container with an std::map-like interface, built from a dense vector of entries and an open-addressing (linear probing) index table.
+         * Entries are stored contiguously in insertion order (also after erase()), so iterating over the map is a plain vector traversal. Calling clear() keeps the allocated capacity, hence a map reused between events does not allocate in the steady state.
+         * As in std::map, the key of an entry is const, so it cannot be changed through an iterator behind the back of the index table.
+         *
+         * @tparam Key key type, has to be copyable and comparable with KeyEqual
+         * @tparam Value mapped type
+         * @tparam Hash hash function object, the result is additionally mixed so identity hashes of packed integer bins are fine
+         * @tparam KeyEqual key comparison function object
+         */
+        template<typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key> >
+        class FlatHashMap
+        {
+            public:
+                using key_type = Key;
+                using mapped_type = Value;
+                using value_type = std::pair<const Key,Value>;
+                using size_type = std::size_t;
+                using iterator = typename std::vector<value_type>::iterator;
+                using const_iterator = typename std::vector<value_type>::const_iterator;
+
+            private:
+                static constexpr std::uint32_t s_emptySlot = 0;
+                static constexpr std::size_t s_minSlotCount = 16;
+
+                std::vector<value_type> m_entries;
+                std::vector<std::uint32_t> m_slots; // index of the entry + 1, 0 marks an empty slot
+                Hash m_hasher;
+                KeyEqual m_keyEqual;
+
+                /**
+                 * @brief Get the preferred slot of the key
+                 *
+                 * @param key key object
+                 * @return std::size_t index of the slot
+                 */
+                [[nodiscard]] std::size_t HomeSlot(const Key &key) const noexcept
+                {
+                    std::uint64_t hash = static_cast<std::uint64_t>(m_hasher(key));
+                    // finaliser of MurmurHash3, spreads the low-entropy hashes of small integers over all bits
+                    hash ^= hash >> 33;
+                    hash *= 0xff51afd7ed558ccdULL;
+                    hash ^= hash >> 33;
+                    return static_cast<std::size_t>(hash) & (m_slots.size() - 1);
+                }
+                /**
+                 * @brief Find the slot which holds the given key or the first empty slot where it should be placed
+                 *
+                 * @param key key object
+                 * @return std::size_t index of the slot
+                 */
+                [[nodiscard]] std::size_t FindSlot(const Key &key) const noexcept
+                {
+                    const std::size_t mask = m_slots.size() - 1;
+                    std::size_t slot = HomeSlot(key);
+                    while (m_slots[slot] != s_emptySlot && !m_keyEqual(m_entries[m_slots[slot] - 1].first,key))
+                        slot = (slot + 1) & mask;
+
+                    return slot;
+                }
+                /**
+                 * @brief Rebuild the index table with given number of slots
+                 *
+                 * @param slotCount new number of slots, must be a power of two
+                 */
+                void Rehash(std::size_t slotCount)
+                {
+                    m_slots.assign(slotCount,s_emptySlot);
+                    for (std::size_t index = 0; index < m_entries.size(); ++index)
+                        m_slots[FindSlot(m_entries[index].first)] = static_cast<std::uint32_t>(index + 1);
+                }
+                /**
+                 * @brief Make sure that one more entry can be inserted while keeping the load factor below 1/2
+                 *
+                 */
+                void GrowIfNeeded()
+                {
+                    if (2 * (m_entries.size() + 1) > m_slots.size())
+                        Rehash((m_slots.empty()) ? s_minSlotCount : 2 * m_slots.size());
+                }
+
+            public:
+                /**
+                 * @brief Default constructor. No memory is allocated until the first insertion.
+                 *
+                 */
+                FlatHashMap() = default;
+                FlatHashMap(const FlatHashMap &) = default;
+                FlatHashMap(FlatHashMap &&) = default;
+                /**
+                 * @brief Copy assignment. The keys are const, so the entries of the copy are constructed anew instead of being assigned.
+                 *
+                 * @param other map to copy
+                 * @return FlatHashMap& this map
+                 */
+                FlatHashMap& operator=(const FlatHashMap &other)
+                {
+                    if (this != &other)
+                    {
+                        FlatHashMap copy(other);
+                        *this = std::move(copy);
+                    }
+                    return *this;
+                }
+                FlatHashMap& operator=(FlatHashMap &&) = default;
+
+                [[nodiscard]] iterator begin() noexcept {return m_entries.begin();}
+                [[nodiscard]] iterator end() noexcept {return m_entries.end();}
+                [[nodiscard]] const_iterator begin() const noexcept {return m_entries.begin();}
+                [[nodiscard]] const_iterator end() const noexcept {return m_entries.end();}
+                [[nodiscard]] const_iterator cbegin() const noexcept {return m_entries.cbegin();}
+                [[nodiscard]] const_iterator cend() const noexcept {return m_entries.cend();}
+
+                /**
+                 * @brief Get the number of stored entries.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t size() const noexcept {return m_entries.size();}
+                /**
+                 * @brief Check if the map holds no entries.
+                 *
+                 * @return true Map is empty.
+                 * @return false Map is not empty.
+                 */
+                [[nodiscard]] bool empty() const noexcept {return m_entries.empty();}
+                /**
+                 * @brief Remove all entries. The allocated memory is kept for later use.
+                 *
+                 */
+                void clear() noexcept
+                {
+                    m_entries.clear();
+                    std::fill(m_slots.begin(),m_slots.end(),s_emptySlot);
+                }
+                /**
+                 * @brief Reserve memory for given number of entries.
+                 *
+                 * @param count expected number of entries
+                 */
+                void reserve(std::size_t count)
+                {
+                    m_entries.reserve(count);
+                    std::size_t slotCount = s_minSlotCount;
+                    while (slotCount < 2 * count)
+                        slotCount *= 2;
+                    if (slotCount > m_slots.size())
+                        Rehash(slotCount);
+                }
+                /**
+                 * @brief Find the entry with given key.
+                 *
+                 * @param key key object
+                 * @return iterator to the entry or end() if the key is not present
+                 */
+                [[nodiscard]] iterator find(const Key &key) noexcept
+                {
+                    if (m_entries.empty())
+                        return end();
+
+                    const std::uint32_t slotValue = m_slots[FindSlot(key)];
+                    return (slotValue == s_emptySlot) ? end() : m_entries.begin() + (slotValue - 1);
+                }
+                /**
+                 * @brief Find the entry with given key.
+                 *
+                 * @param key key object
+                 * @return const_iterator to the entry or end() if the key is not present
+                 */
+                [[nodiscard]] const_iterator find(const Key &key) const noexcept
+                {
+                    if (m_entries.empty())
+                        return end();
+
+                    const std::uint32_t slotValue = m_slots[FindSlot(key)];
+                    return (slotValue == s_emptySlot) ? end() : m_entries.cbegin() + (slotValue - 1);
+                }
+                /**
+                 * @brief Count the entries with given key.
+                 *
+                 * @param key key object
+                 * @return std::size_t 1 if the key is present, 0 otherwise
+                 */
+                [[nodiscard]] std::size_t count(const Key &key) const noexcept {return (find(key) == end()) ? 0 : 1;}
+                /**
+                 * @brief Insert a new entry constructed from given arguments, unless the key is already present.
+                 *
+                 * @tparam Args value constructor argument types
+                 * @param key key object
+                 * @param args value constructor arguments
+                 * @return std::pair<iterator,bool> iterator to the entry and true if the insertion took place
+                 */
+                template<typename... Args>
+                std::pair<iterator,bool> try_emplace(const Key &key, Args&&... args)
+                {
+                    GrowIfNeeded();
+                    const std::size_t slot = FindSlot(key);
+                    if (m_slots[slot] != s_emptySlot)
+                        return {m_entries.begin() + (m_slots[slot] - 1),false};
+
+                    m_entries.emplace_back(std::piecewise_construct,std::forward_as_tuple(key),std::forward_as_tuple(std::forward<Args>(args)...));
+                    m_slots[slot] = static_cast<std::uint32_t>(m_entries.size());
+                    return {std::prev(m_entries.end()),true};
+                }
+                /**
+                 * @brief Insert a new entry, unless the key is already present.
+                 *
+                 * @tparam V value type
+                 * @param key key object
+                 * @param value value object
+                 * @return std::pair<iterator,bool> iterator to the entry and true if the insertion took place
+                 */
+                template<typename V>
+                std::pair<iterator,bool> emplace(const Key &key, V &&value) {return try_emplace(key,std::forward<V>(value));}
+                /**
+                 * @brief Access the value with given key, default-constructing it if the key is not present.
+                 *
+                 * @param key key object
+                 * @return Value&
+                 */
+                Value& operator[](const Key &key) {return try_emplace(key).first->second;}
+                /**
+                 * @brief Access the value with given key.
+                 *
+                 * @param key key object
+                 * @return Value&
+                 * @throws std::out_of_range if the key is not present
+                 */
+                Value& at(const Key &key)
+                {
+                    auto iter = find(key);
+                    if (iter == end())
+                        throw std::out_of_range("JJUtils::FlatHashMap::at: key not found");
+                    return iter->second;
+                }
+                /**
+                 * @brief Access the value with given key.
+                 *
+                 * @param key key object
+                 * @return const Value&
+                 * @throws std::out_of_range if the key is not present
+                 */
+                const Value& at(const Key &key) const
+                {
+                    auto iter = find(key);
+                    if (iter == end())
+                        throw std::out_of_range("JJUtils::FlatHashMap::at: key not found");
+                    return iter->second;
+                }
+                /**
+                 * @brief Remove the entry with given key. The following entries move one place back, so the insertion order is kept and iterators to them are invalidated. Linear in the size of the map.
+                 *
+                 * @param key key object
+                 * @return std::size_t number of removed entries (0 or 1)
+                 */
+                std::size_t erase(const Key &key)
+                {
+                    if (m_entries.empty())
+                        return 0;
+
+                    const std::size_t mask = m_slots.size() - 1;
+                    std::size_t slot = FindSlot(key);
+                    if (m_slots[slot] == s_emptySlot)
+                        return 0;
+
+                    const std::size_t index = m_slots[slot] - 1;
+
+                    // backward-shift deletion: move up every following entry of the probe chain which may occupy the freed slot
+                    for (std::size_t next = (slot + 1) & mask; m_slots[next] != s_emptySlot; next = (next + 1) & mask)
+                    {
+                        const std::size_t home = HomeSlot(m_entries[m_slots[next] - 1].first);
+                        if (((next - home) & mask) >= ((next - slot) & mask))
+                        {
+                            m_slots[slot] = m_slots[next];
+                            slot = next;
+                        }
+                    }
+                    m_slots[slot] = s_emptySlot;
+
+                    if (index + 1 == m_entries.size())
+                    {
+                        m_entries.pop_back();
+                        return 1;
+                    }
+
+                    // the keys are const, so the following entries cannot be assigned one place back; the entries are rebuilt without the erased one instead
+                    std::vector<value_type> entries;
+                    entries.reserve(m_entries.capacity());
+                    for (std::size_t iter = 0; iter < m_entries.size(); ++iter)
+                        if (iter != index)
+                            entries.emplace_back(std::move(m_entries[iter]));
+
+                    m_entries.swap(entries);
+                    for (auto &slotValue : m_slots)
+                        if (slotValue > index + 1)
+                            --slotValue;
+
+                    return 1;
+                }
+        };
+    }
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * @file JJMixerCounters.hxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Performance counters and stage timers of the mixer
+ * @version 1.0
+ * @date 2024-12-19
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef JJMixerCounters_hxx
+    #define JJMixerCounters_hxx
+
+    #include <chrono>
+    #include <cstdint>
+    #include <cstddef>
+    #include <iostream>
+
+    namespace Mixing
+    {
+        /**
+         * @brief Counters and per-stage timers collected by the mixer when JJFemtoMixer::EnableCounters(true) was called.
+         * The stages are: storing events in the mixing buffers (store), constructing and classifying the pairs (build), and grouping the classified pairs (sort).
+         * In the visitor methods the build stage also contains the time spent in the visitor.
+         *
+         */
+        struct JJMixerCounters
+        {
+            std::uint64_t signalCalls = 0; ///< number of AddEvent-like calls
+            std::uint64_t backgroundCalls = 0; ///< number of GetSimilarPairs-like calls
+            std::uint64_t pairsBuilt = 0; ///< number of constructed and classified pairs
+            std::uint64_t pairsCut = 0; ///< number of pairs rejected by the pair cut (put into the "bad" group)
+            std::uint64_t pairsPreCut = 0; ///< number of track combinations rejected by the pair pre-cut (never constructed)
+            std::uint64_t groupsCreated = 0; ///< total number of groups in the returned pair collections
+            std::uint64_t bytesAllocated = 0; ///< estimated number of bytes allocated for the pairs and pair collections
+            std::uint64_t storeNanoseconds = 0; ///< time spent in the store stage
+            std::uint64_t buildNanoseconds = 0; ///< time spent in the build stage
+            std::uint64_t sortNanoseconds = 0; ///< time spent in the sort stage
+
+            /**
+             * @brief Prints the counters to given stream.
+             *
+             * @param os output stream
+             */
+            void Print(std::ostream &os = std::cout) const
+            {
+                os << "\n------=============== JJFemtoMixer Counters ===============------\n";
+                os << "Signal calls: " << signalCalls << "\tBackground calls: " << backgroundCalls << "\n";
+                os << "Pairs built: " << pairsBuilt << "\tcut: " << pairsCut << "\tpre-cut: " << pairsPreCut << "\n";
+                os << "Groups created: " << groupsCreated << "\n";
+                os << "Bytes allocated (estimate): " << bytesAllocated << "\n";
+                os << "Stage times [ms]: store " << storeNanoseconds * 1e-6 << "\tbuild " << buildNanoseconds * 1e-6 << "\tsort " << sortNanoseconds * 1e-6 << "\n";
+                os << "------=====================================================------\n" << std::endl;
+            }
+        };
+
+        namespace Detail
+        {
+            /**
+             * @brief Adds the lifetime of the object to given nanosecond counter. Does nothing (not even reads the clock) if the counter is nullptr.
+             *
+             */
+            class StageTimer
+            {
+                private:
+                    std::uint64_t *m_target;
+                    std::chrono::steady_clock::time_point m_start;
+
+                public:
+                    explicit StageTimer(std::uint64_t *target) noexcept : m_target(target)
+                    {
+                        if (m_target != nullptr)
+                            m_start = std::chrono::steady_clock::now();
+                    }
+                    StageTimer(const StageTimer &) = delete;
+                    StageTimer& operator=(const StageTimer &) = delete;
+                    ~StageTimer()
+                    {
+                        if (m_target != nullptr)
+                            *m_target += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+                    }
+            };
+
+            /**
+             * @brief Estimated heap size of an object owned by a std::shared_ptr (the object and its control block)
+             *
+             * @tparam T object type
+             * @return constexpr std::size_t
+             */
+            template<typename T>
+            constexpr std::size_t SharedObjectBytes() noexcept {return sizeof(T) + 3 * sizeof(void*);}
+        }
+    }
+
+#endif
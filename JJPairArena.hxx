@@ -0,0 +1,267 @@
+/**
+ * @file JJPairArena.hxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Contiguous, reusable storage of value-type pairs grouped by the pair hash
+ * @version 1.0
+ * @date 2024-12-04
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef JJPairArena_hxx
+    #define JJPairArena_hxx
+
+    #include <vector>
+    #include <utility>
+    #include <iterator>
+    #include <cstddef>
+    #include "JJFlatHashMap.hxx"
+
+    namespace Mixing
+    {
+        /**
+         * @brief Storage of pairs built by value in one contiguous block. Pairs are kept in the order of construction, while each group is a span of indices into that block.
+         * Reset() destroys the pairs but keeps all of the allocated memory, so an arena reused between events does no allocations in the steady state.
+         *
+         * @tparam Pair pair type
+         * @tparam PairKey type of the pair hash
+         */
+        template<typename Pair, typename PairKey>
+        class JJPairArena
+        {
+            public:
+                /**
+                 * @brief Read-only view of a single group of pairs stored in the arena. Valid until the arena is reset.
+                 *
+                 */
+                class Group
+                {
+                    public:
+                        /**
+                         * @brief Iterator over the pairs of a group.
+                         *
+                         */
+                        class Iterator
+                        {
+                            private:
+                                const Pair *m_pairs;
+                                const std::size_t *m_index;
+
+                            public:
+                                using iterator_category = std::forward_iterator_tag;
+                                using value_type = Pair;
+                                using difference_type = std::ptrdiff_t;
+                                using pointer = const Pair*;
+                                using reference = const Pair&;
+
+                                Iterator(const Pair *pairs, const std::size_t *index) noexcept : m_pairs(pairs), m_index(index) {}
+                                [[nodiscard]] const Pair& operator*() const noexcept {return m_pairs[*m_index];}
+                                [[nodiscard]] const Pair* operator->() const noexcept {return m_pairs + *m_index;}
+                                Iterator& operator++() noexcept {++m_index; return *this;}
+                                Iterator operator++(int) noexcept {Iterator tmp = *this; ++m_index; return tmp;}
+                                [[nodiscard]] bool operator==(const Iterator &other) const noexcept {return m_index == other.m_index;}
+                                [[nodiscard]] bool operator!=(const Iterator &other) const noexcept {return m_index != other.m_index;}
+                        };
+
+                    private:
+                        const Pair *m_pairs;
+                        const std::size_t *m_begin, *m_end;
+
+                    public:
+                        Group(const Pair *pairs, const std::size_t *begin, const std::size_t *end) noexcept : m_pairs(pairs), m_begin(begin), m_end(end) {}
+                        [[nodiscard]] Iterator begin() const noexcept {return Iterator(m_pairs,m_begin);}
+                        [[nodiscard]] Iterator end() const noexcept {return Iterator(m_pairs,m_end);}
+                        /**
+                         * @brief Get the number of pairs in the group.
+                         *
+                         * @return std::size_t
+                         */
+                        [[nodiscard]] std::size_t size() const noexcept {return static_cast<std::size_t>(m_end - m_begin);}
+                        /**
+                         * @brief Check if the group has no pairs.
+                         *
+                         * @return true Group is empty.
+                         * @return false Group is not empty.
+                         */
+                        [[nodiscard]] bool empty() const noexcept {return m_begin == m_end;}
+                        /**
+                         * @brief Access n-th pair of the group.
+                         *
+                         * @param n position in the group
+                         * @return const Pair&
+                         */
+                        [[nodiscard]] const Pair& operator[](std::size_t n) const noexcept {return m_pairs[m_begin[n]];}
+                };
+
+                /**
+                 * @brief Iterator over the groups of the arena, dereferences to (key, group) so structured bindings can be used.
+                 *
+                 */
+                class Iterator
+                {
+                    private:
+                        const JJPairArena *m_arena;
+                        std::size_t m_group;
+
+                    public:
+                        using iterator_category = std::forward_iterator_tag;
+                        using value_type = std::pair<const PairKey&, Group>;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = void;
+                        using reference = value_type;
+
+                        Iterator(const JJPairArena *arena, std::size_t group) noexcept : m_arena(arena), m_group(group) {}
+                        [[nodiscard]] value_type operator*() const noexcept {return {m_arena->m_groupKeys[m_group],m_arena->GetGroupAt(m_group)};}
+                        Iterator& operator++() noexcept {++m_group; return *this;}
+                        Iterator operator++(int) noexcept {Iterator tmp = *this; ++m_group; return tmp;}
+                        [[nodiscard]] bool operator==(const Iterator &other) const noexcept {return m_group == other.m_group;}
+                        [[nodiscard]] bool operator!=(const Iterator &other) const noexcept {return m_group != other.m_group;}
+                };
+
+            private:
+                std::vector<Pair> m_pairs;
+                std::vector<std::size_t> m_pairGroup; // group index of each pair
+                std::vector<std::size_t> m_order; // pair indices sorted by group
+                std::vector<std::size_t> m_groupOffsets; // group i occupies m_order[m_groupOffsets[i]] to m_order[m_groupOffsets[i+1]]
+                std::vector<PairKey> m_groupKeys;
+                JJUtils::FlatHashMap<PairKey,std::size_t> m_groupIndex;
+
+                /**
+                 * @brief Get the view of the group with given index
+                 *
+                 * @param group group index
+                 * @return Group
+                 */
+                [[nodiscard]] Group GetGroupAt(std::size_t group) const noexcept
+                {
+                    return Group(m_pairs.data(),m_order.data() + m_groupOffsets[group],m_order.data() + m_groupOffsets[group + 1]);
+                }
+
+            public:
+                /**
+                 * @brief Default constructor. Create an empty arena.
+                 *
+                 */
+                JJPairArena() = default;
+
+                /**
+                 * @brief Destroy all stored pairs and groups while keeping the allocated memory.
+                 *
+                 */
+                void Reset() noexcept
+                {
+                    m_pairs.clear();
+                    m_pairGroup.clear();
+                    m_order.clear();
+                    m_groupOffsets.clear();
+                    m_groupKeys.clear();
+                    m_groupIndex.clear();
+                }
+                /**
+                 * @brief Reserve memory for given number of pairs.
+                 *
+                 * @param nPairs expected number of pairs
+                 */
+                void Reserve(std::size_t nPairs)
+                {
+                    m_pairs.reserve(nPairs);
+                    m_pairGroup.reserve(nPairs);
+                    m_order.reserve(nPairs);
+                }
+                /**
+                 * @brief Construct a new pair in the arena. References to previously emplaced pairs may be invalidated if the reserved memory is exceeded.
+                 *
+                 * @tparam Args pair constructor argument types
+                 * @param args pair constructor arguments
+                 * @return Pair& the new pair
+                 */
+                template<typename... Args>
+                Pair& Emplace(Args&&... args)
+                {
+                    m_pairGroup.push_back(0);
+                    return m_pairs.emplace_back(std::forward<Args>(args)...);
+                }
+                /**
+                 * @brief Assign the most recently emplaced pair to the group with given hash.
+                 *
+                 * @param key pair hash
+                 */
+                void AssignLast(const PairKey &key)
+                {
+                    auto [iter,inserted] = m_groupIndex.try_emplace(key,m_groupKeys.size());
+                    if (inserted)
+                        m_groupKeys.push_back(key);
+
+                    m_pairGroup.back() = iter->second;
+                }
+                /**
+                 * @brief Sort the pair indices by group (counting sort). Has to be called after the last pair was emplaced and before the groups are accessed.
+                 *
+                 */
+                void BuildGroups()
+                {
+                    const std::size_t nGroups = m_groupKeys.size();
+                    m_groupOffsets.assign(nGroups + 1,0);
+                    for (const std::size_t group : m_pairGroup)
+                        ++m_groupOffsets[group + 1];
+                    for (std::size_t group = 0; group < nGroups; ++group)
+                        m_groupOffsets[group + 1] += m_groupOffsets[group];
+
+                    m_order.resize(m_pairs.size());
+                    // during the scatter m_groupOffsets[i] is the insertion point of group i, afterwards it is shifted back to hold the group starts
+                    for (std::size_t index = 0; index < m_pairGroup.size(); ++index)
+                        m_order[m_groupOffsets[m_pairGroup[index]]++] = index;
+                    for (std::size_t group = nGroups; group > 0; --group)
+                        m_groupOffsets[group] = m_groupOffsets[group - 1];
+                    m_groupOffsets[0] = 0;
+                }
+
+                [[nodiscard]] Iterator begin() const noexcept {return Iterator(this,0);}
+                [[nodiscard]] Iterator end() const noexcept {return Iterator(this,m_groupKeys.size());}
+
+                /**
+                 * @brief Get the group of pairs with given hash.
+                 *
+                 * @param key pair hash
+                 * @return Group view of the group, empty if there are no pairs with such hash
+                 */
+                [[nodiscard]] Group GetGroup(const PairKey &key) const noexcept
+                {
+                    auto iter = m_groupIndex.find(key);
+                    if (iter == m_groupIndex.end())
+                        return Group(m_pairs.data(),nullptr,nullptr);
+
+                    return GetGroupAt(iter->second);
+                }
+                /**
+                 * @brief Get the number of groups.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetNGroups() const noexcept {return m_groupKeys.size();}
+                /**
+                 * @brief Get the total number of stored pairs.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t size() const noexcept {return m_pairs.size();}
+                /**
+                 * @brief Get the number of bytes currently allocated by the arena (capacity of the pair and index storage).
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetAllocatedBytes() const noexcept
+                {
+                    return m_pairs.capacity() * sizeof(Pair) + (m_pairGroup.capacity() + m_order.capacity() + m_groupOffsets.capacity()) * sizeof(std::size_t) + m_groupKeys.capacity() * sizeof(PairKey);
+                }
+                /**
+                 * @brief Get all stored pairs in the order of construction.
+                 *
+                 * @return const std::vector<Pair>&
+                 */
+                [[nodiscard]] const std::vector<Pair>& GetPairs() const noexcept {return m_pairs;}
+        };
+    }
+
+#endif
@@ -0,0 +1,165 @@
+/**
+ * @file JJTaskPool.hxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Small pool of worker threads used to run parallel loops
+ * @version 1.0
+ * @date 2024-12-09
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef JJTaskPool_hxx
+    #define JJTaskPool_hxx
+
+    #include <vector>
+    #include <deque>
+    #include <thread>
+    #include <mutex>
+    #include <condition_variable>
+    #include <atomic>
+    #include <functional>
+    #include <memory>
+    #include <algorithm>
+    #include <cstddef>
+
+    namespace JJUtils
+    {
+        /**
+         * @brief Fixed set of worker threads executing parallel loops. The items of a loop are claimed one by one from a shared counter, so an idle thread always takes over the remaining work of the busy ones (the load is balanced even if the items differ in cost).
+         * The thread calling ParallelFor() takes part in the loop, hence the pool can be used from several threads at the same time without a risk of a deadlock.
+         *
+         */
+        class TaskPool
+        {
+            private:
+                /**
+                 * @brief Shared state of a single parallel loop. Owned jointly by the caller and the helper tasks, so a helper which starts after the loop has finished never touches freed memory.
+                 *
+                 */
+                struct LoopState
+                {
+                    std::atomic<std::size_t> nextItem{0}, doneItems{0};
+                    std::size_t nItems = 0;
+                    const std::function<void(std::size_t)> *body = nullptr;
+                    std::mutex mutex;
+                    std::condition_variable finished;
+                };
+
+                std::vector<std::thread> m_workers;
+                std::deque<std::function<void()> > m_tasks;
+                std::mutex m_mutex;
+                std::condition_variable m_newTask;
+                bool m_stop;
+
+                /**
+                 * @brief Claim and execute the items of the loop until there are none left
+                 *
+                 * @param state loop state
+                 */
+                static void RunLoop(LoopState &state)
+                {
+                    std::size_t item, nDone = 0;
+                    while ((item = state.nextItem.fetch_add(1,std::memory_order_relaxed)) < state.nItems)
+                    {
+                        (*state.body)(item);
+                        ++nDone;
+                    }
+
+                    if (nDone > 0 && state.doneItems.fetch_add(nDone,std::memory_order_acq_rel) + nDone == state.nItems)
+                    {
+                        std::lock_guard<std::mutex> lock(state.mutex);
+                        state.finished.notify_all();
+                    }
+                }
+                /**
+                 * @brief Main function of each worker thread
+                 *
+                 */
+                void WorkerLoop()
+                {
+                    while (true)
+                    {
+                        std::function<void()> task;
+                        {
+                            std::unique_lock<std::mutex> lock(m_mutex);
+                            m_newTask.wait(lock,[this]{return m_stop || !m_tasks.empty();});
+                            if (m_stop && m_tasks.empty())
+                                return;
+
+                            task = std::move(m_tasks.front());
+                            m_tasks.pop_front();
+                        }
+                        task();
+                    }
+                }
+
+            public:
+                /**
+                 * @brief Create the pool.
+                 *
+                 * @param nThreads Total number of threads taking part in a loop (including the calling thread), i.e. nThreads - 1 workers are started. Values 0 and 1 mean that the loops run serially.
+                 */
+                explicit TaskPool(std::size_t nThreads) : m_stop(false)
+                {
+                    for (std::size_t iter = 1; iter < nThreads; ++iter)
+                        m_workers.emplace_back(&TaskPool::WorkerLoop,this);
+                }
+                TaskPool(const TaskPool &) = delete;
+                TaskPool& operator=(const TaskPool &) = delete;
+                /**
+                 * @brief Destroy the pool. Waits for all of the started tasks to finish.
+                 *
+                 */
+                ~TaskPool()
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_stop = true;
+                    }
+                    m_newTask.notify_all();
+                    for (auto &worker : m_workers)
+                        worker.join();
+                }
+
+                /**
+                 * @brief Get the total number of threads taking part in a loop.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t GetNThreads() const noexcept {return m_workers.size() + 1;}
+                /**
+                 * @brief Call body(i) for every i in [0, nItems) using the workers and the calling thread. Returns when all items are done. The body must not throw.
+                 *
+                 * @param nItems number of loop items
+                 * @param body loop body
+                 */
+                void ParallelFor(std::size_t nItems, const std::function<void(std::size_t)> &body)
+                {
+                    if (nItems == 0)
+                        return;
+
+                    auto state = std::make_shared<LoopState>();
+                    state->nItems = nItems;
+                    state->body = &body;
+
+                    const std::size_t nHelpers = std::min(m_workers.size(),nItems - 1);
+                    if (nHelpers > 0)
+                    {
+                        {
+                            std::lock_guard<std::mutex> lock(m_mutex);
+                            for (std::size_t iter = 0; iter < nHelpers; ++iter)
+                                m_tasks.emplace_back([state]{RunLoop(*state);});
+                        }
+                        m_newTask.notify_all();
+                    }
+
+                    RunLoop(*state);
+
+                    std::unique_lock<std::mutex> lock(state->mutex);
+                    state->finished.wait(lock,[&state]{return state->doneItems.load(std::memory_order_acquire) == state->nItems;});
+                }
+        };
+    }
+
+#endif
@@ -0,0 +1,153 @@
+/**
+ * @file JJTrackSoA.hxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Structure-of-arrays track layout and the vectorised pair pre-cut
+ * @version 1.0
+ * @date 2024-12-16
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef JJTrackSoA_hxx
+    #define JJTrackSoA_hxx
+
+    #include <vector>
+    #include <memory>
+    #include <cmath>
+    #include <limits>
+    #include <cstdint>
+    #include <cstddef>
+    #include <type_traits>
+    #include <utility>
+
+    namespace Mixing
+    {
+        /**
+         * @brief Access to the four-momentum of a track. Specialise this struct for your track class to enable the pair pre-cut, e.g.:
+         * @code
+         * template<> struct Mixing::TrackKinematics<MyTrack>
+         * {
+         *     static float Px(const MyTrack &track) {return track.px;}
+         *     static float Py(const MyTrack &track) {return track.py;}
+         *     static float Pz(const MyTrack &track) {return track.pz;}
+         *     static float E(const MyTrack &track) {return track.energy;}
+         * };
+         * @endcode
+         *
+         * @tparam Track track type
+         */
+        template<typename Track>
+        struct TrackKinematics;
+
+        namespace Detail
+        {
+            /**
+             * @brief Check if TrackKinematics was specialised for given track type
+             *
+             */
+            template<typename Track, typename Enable = void>
+            struct HasTrackKinematics : std::false_type {};
+
+            template<typename Track>
+            struct HasTrackKinematics<Track, std::void_t<decltype(TrackKinematics<Track>::Px(std::declval<const Track&>())),
+                                                         decltype(TrackKinematics<Track>::Py(std::declval<const Track&>())),
+                                                         decltype(TrackKinematics<Track>::Pz(std::declval<const Track&>())),
+                                                         decltype(TrackKinematics<Track>::E(std::declval<const Track&>()))> > : std::true_type {};
+        }
+
+        /**
+         * @brief Cut on the common pair variables, applied before the pair object is constructed. The default values accept all pairs.
+         * Pairs rejected by the pre-cut are not built at all, i.e. they don't show up in the "bad" group.
+         *
+         */
+        struct JJPairPreCut
+        {
+            float minQinv = 0.f; ///< minimal invariant relative momentum
+            float maxQinv = std::numeric_limits<float>::infinity(); ///< maximal invariant relative momentum
+            float minKt = 0.f; ///< minimal average transverse momentum of the pair
+            float maxKt = std::numeric_limits<float>::infinity(); ///< maximal average transverse momentum of the pair
+            float minOpeningAngle = 0.f; ///< minimal opening angle between the momenta (in radians)
+        };
+
+        /**
+         * @brief Momenta of tracks stored as separate arrays (structure of arrays), so the pair variables can be computed for many pairs at once with SIMD instructions.
+         *
+         */
+        class JJTrackSoA
+        {
+            public:
+                static constexpr std::size_t BlockSize = 256; ///< number of pairs processed by a single call of PreCutBlock()
+
+                std::vector<float> px, py, pz, e, p;
+
+                /**
+                 * @brief Fill the arrays from given tracks. The memory is reused if the object is refilled.
+                 *
+                 * @tparam Track track type with a TrackKinematics specialisation
+                 * @param tracks tracks vector
+                 */
+                template<typename Track>
+                void Assign(const std::vector<std::shared_ptr<Track> > &tracks)
+                {
+                    const std::size_t nTracks = tracks.size();
+                    px.resize(nTracks);
+                    py.resize(nTracks);
+                    pz.resize(nTracks);
+                    e.resize(nTracks);
+                    p.resize(nTracks);
+
+                    for (std::size_t iter = 0; iter < nTracks; ++iter)
+                    {
+                        const Track &track = *tracks[iter];
+                        px[iter] = static_cast<float>(TrackKinematics<Track>::Px(track));
+                        py[iter] = static_cast<float>(TrackKinematics<Track>::Py(track));
+                        pz[iter] = static_cast<float>(TrackKinematics<Track>::Pz(track));
+                        e[iter] = static_cast<float>(TrackKinematics<Track>::E(track));
+                        p[iter] = std::sqrt(px[iter] * px[iter] + py[iter] * py[iter] + pz[iter] * pz[iter]);
+                    }
+                }
+                /**
+                 * @brief Get the number of stored tracks.
+                 *
+                 * @return std::size_t
+                 */
+                [[nodiscard]] std::size_t size() const noexcept {return px.size();}
+                /**
+                 * @brief Compute qInv, kT and the opening angle of pairs (first, j) for j in [begin, end) and test them against the pre-cut.
+                 * The loop is branchless and works on squared quantities (no square roots or trigonometric functions), so it is vectorised by the compiler.
+                 *
+                 * @param first index of the first track of each pair
+                 * @param begin index of the second track of the first pair
+                 * @param end index past the second track of the last pair, end - begin must not exceed BlockSize
+                 * @param cut pair pre-cut
+                 * @param accepted output, accepted[j - begin] is 1 if the pair (first, j) passed the pre-cut and 0 otherwise
+                 */
+                void PreCutBlock(std::size_t first, std::size_t begin, std::size_t end, const JJPairPreCut &cut, std::uint8_t (&accepted)[BlockSize]) const noexcept
+                {
+                    // limits are expressed so that the default values accept everything, also pairs with slightly negative qInv^2 due to rounding
+                    const float minQinv2 = (cut.minQinv > 0.f) ? cut.minQinv * cut.minQinv : -std::numeric_limits<float>::infinity();
+                    const float maxQinv2 = cut.maxQinv * cut.maxQinv;
+                    const float minKt2x4 = 4.f * cut.minKt * cut.minKt;
+                    const float maxKt2x4 = 4.f * cut.maxKt * cut.maxKt;
+                    const float maxCos = (cut.minOpeningAngle > 0.f) ? std::cos(cut.minOpeningAngle) : 2.f;
+
+                    const float px1 = px[first], py1 = py[first], pz1 = pz[first], e1 = e[first], p1 = p[first];
+                    const float *px2 = px.data() + begin, *py2 = py.data() + begin, *pz2 = pz.data() + begin, *e2 = e.data() + begin, *p2 = p.data() + begin;
+                    const std::size_t nPairs = end - begin;
+
+                    for (std::size_t iter = 0; iter < nPairs; ++iter)
+                    {
+                        const float dpx = px1 - px2[iter], dpy = py1 - py2[iter], dpz = pz1 - pz2[iter], de = e1 - e2[iter];
+                        const float qInv2 = dpx * dpx + dpy * dpy + dpz * dpz - de * de;
+                        const float spx = px1 + px2[iter], spy = py1 + py2[iter];
+                        const float kt2x4 = spx * spx + spy * spy; // (2 kT)^2
+                        const float dot = px1 * px2[iter] + py1 * py2[iter] + pz1 * pz2[iter]; // |p1||p2|cos(angle)
+
+                        accepted[iter] = static_cast<std::uint8_t>((qInv2 >= minQinv2) & (qInv2 <= maxQinv2) & (kt2x4 >= minKt2x4) & (kt2x4 <= maxKt2x4) & (dot <= maxCos * p1 * p2[iter]));
+                    }
+                }
+        };
+    }
+
+#endif
@@ -31,7 +31,23 @@
         }
 
         /**
-         * @brief Select random element from an STL container
+         * @brief Select random element from an STL container using the provided random number generator
+         * 
+         * @tparam Iter iterator type
+         * @tparam RandomGenerator random number engine type
+         * @param start begin iterator
+         * @param end end iterator
+         * @param g random number engine
+         * @return iterator pointing to a randomly selected element of the container
+         */
+        template<typename Iter, typename RandomGenerator>
+        Iter select_randomly(Iter start, Iter end, RandomGenerator& g) 
+        {
+            return Detail::select_randomly(start, end, g);
+        }
+
+        /**
+         * @brief Select random element from an STL container. Each thread uses its own, randomly seeded generator, so the result is not reproducible. Use the overload taking a generator if you need that.
          * 
          * @tparam Iter iterator type
          * @param start begin iterator
@@ -41,8 +57,7 @@
         template<typename Iter>
         Iter select_randomly(Iter start, Iter end) 
         {
-            static std::random_device rd;
-            static std::mt19937 gen(rd());
+            thread_local std::mt19937 gen(std::random_device{}());
             return Detail::select_randomly(start, end, gen);
         }
     }
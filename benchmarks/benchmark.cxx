@@ -0,0 +1,371 @@
+/**
+ * @file benchmark.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Throughput benchmark of JJFemtoMixer with a synthetic event generator
+ * @version 1.0
+ * @date 2024-12-19
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJFemtoMixerConcurrent.hxx"
+#include "../JJFemtoMixerStatic.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// synthetic objects, the track carries a random number used to decide if a pair is cut
+struct BenchTrack
+{
+    float px, py, pz, e, random;
+};
+
+// lets the pair pre-cut read the momenta of the tracks
+template<> struct Mixing::TrackKinematics<BenchTrack>
+{
+    static float Px(const BenchTrack &track) {return track.px;}
+    static float Py(const BenchTrack &track) {return track.py;}
+    static float Pz(const BenchTrack &track) {return track.pz;}
+    static float E(const BenchTrack &track) {return track.e;}
+};
+
+struct BenchEvent
+{
+    int id;
+    int eventClass;
+    std::string GetID() const {return std::to_string(id);}
+};
+
+struct BenchPair
+{
+    float qInv, random;
+    BenchPair(const std::shared_ptr<BenchTrack> &trck1, const std::shared_ptr<BenchTrack> &trck2)
+    {
+        const float dpx = trck1->px - trck2->px, dpy = trck1->py - trck2->py, dpz = trck1->pz - trck2->pz, de = trck1->e - trck2->e;
+        qInv = std::sqrt(std::fabs(dpx * dpx + dpy * dpy + dpz * dpz - de * de));
+        random = trck1->random + trck2->random;
+        random -= std::floor(random);
+    }
+};
+
+struct BenchSettings
+{
+    int nEvents = 10000;
+    int nClasses = 10;
+    int multiplicity = 50;
+    std::string distribution = "poisson"; // fixed, poisson or flat
+    std::size_t bufferSize = 10;
+    std::size_t tracksPerEvent = 1;
+    std::size_t memoryBudget = 0; // 0 means unlimited
+    double cutFraction = 0.;
+    float preCutQinv = 0.f; // maximal qInv of the pair pre-cut, 0 means no pre-cut
+    std::string mode = "map"; // map, typed, arena, visitor, cache, static or concurrent
+    std::size_t nThreads = std::max(1u, std::thread::hardware_concurrency()); // threads adding events in the concurrent mode
+    bool counters = false;
+};
+
+struct BenchResult
+{
+    double signalSeconds = 0., backgroundSeconds = 0.;
+    std::size_t signalPairs = 0, backgroundPairs = 0;
+};
+
+// pre-generated events, so the generator does not contribute to the measured time
+struct GeneratedEvent
+{
+    std::shared_ptr<BenchEvent> event;
+    std::vector<std::shared_ptr<BenchTrack> > tracks;
+};
+
+std::vector<GeneratedEvent> GenerateEvents(const BenchSettings &settings)
+{
+    std::mt19937 generator(12345);
+    std::poisson_distribution<int> poisson(settings.multiplicity);
+    std::uniform_int_distribution<int> flat(2, std::max(2, 2 * settings.multiplicity - 2));
+    std::uniform_int_distribution<int> eventClass(0, settings.nClasses - 1);
+    std::uniform_real_distribution<float> momentum(-1.f, 1.f), uniform(0.f, 1.f);
+
+    std::vector<GeneratedEvent> events(settings.nEvents);
+    for (int iter = 0; iter < settings.nEvents; ++iter)
+    {
+        int nTracks = settings.multiplicity;
+        if (settings.distribution == "poisson")
+            nTracks = poisson(generator);
+        else if (settings.distribution == "flat")
+            nTracks = flat(generator);
+
+        events[iter].event = std::make_shared<BenchEvent>(BenchEvent{iter, eventClass(generator)});
+        events[iter].tracks.reserve(nTracks);
+        for (int track = 0; track < nTracks; ++track)
+        {
+            const float px = momentum(generator), py = momentum(generator), pz = momentum(generator);
+            events[iter].tracks.push_back(std::make_shared<BenchTrack>(BenchTrack{px, py, pz, std::sqrt(px * px + py * py + pz * pz + 0.0195f), uniform(generator)}));
+        }
+    }
+
+    return events;
+}
+
+using Clock = std::chrono::steady_clock;
+
+// settings common to all of the mixer variants
+template<typename Mixer>
+void ConfigureMixer(Mixer &mixer, const BenchSettings &settings)
+{
+    mixer.SetMaxBufferSize(settings.bufferSize);
+    mixer.SetTracksPerEvent(settings.tracksPerEvent);
+    mixer.SetMemoryBudget(settings.memoryBudget);
+    mixer.SetSeed(2024);
+
+    if (settings.preCutQinv > 0.f)
+    {
+        Mixing::JJPairPreCut preCut;
+        preCut.maxQinv = settings.preCutQinv;
+        mixer.SetPairPreCut(preCut);
+    }
+}
+
+// adds the events in given range with AddEvent and GetSimilarPairs, which all of the mixer variants have
+template<typename Mixer>
+BenchResult RunPairMapLoop(Mixer &mixer, const std::vector<GeneratedEvent> &events, std::size_t first, std::size_t step)
+{
+    BenchResult result;
+    for (std::size_t iter = first; iter < events.size(); iter += step)
+    {
+        const auto &[event, tracks] = events[iter];
+        const auto signalStart = Clock::now();
+        for (const auto &[key, pairs] : mixer.AddEvent(event,tracks))
+            result.signalPairs += pairs.size();
+        const auto backgroundStart = Clock::now();
+        for (const auto &[key, pairs] : mixer.GetSimilarPairs(event))
+            result.backgroundPairs += pairs.size();
+        const auto backgroundEnd = Clock::now();
+
+        result.signalSeconds += std::chrono::duration<double>(backgroundStart - signalStart).count();
+        result.backgroundSeconds += std::chrono::duration<double>(backgroundEnd - backgroundStart).count();
+    }
+
+    return result;
+}
+
+template<typename EventKey, typename PairKey>
+BenchResult RunBenchmark(const BenchSettings &settings, const std::vector<GeneratedEvent> &events)
+{
+    Mixing::JJFemtoMixer<BenchEvent,BenchTrack,BenchPair,EventKey,PairKey> mixer;
+    ConfigureMixer(mixer,settings);
+    mixer.EnableCounters(settings.counters);
+    mixer.SetBackgroundPairCaching(settings.mode == "cache");
+
+    if constexpr (std::is_same_v<EventKey,std::string>)
+        mixer.SetEventHashingFunction([](const std::shared_ptr<BenchEvent> &event){return std::to_string(event->eventClass);});
+    else
+        mixer.SetEventHashingFunction([](const std::shared_ptr<BenchEvent> &event){return static_cast<EventKey>(event->eventClass);});
+
+    const double cutFraction = settings.cutFraction;
+    if (cutFraction > 0.)
+        mixer.SetPairCuttingFunction([cutFraction](const std::shared_ptr<BenchPair> &pair){return pair->random < cutFraction;});
+
+    BenchResult result;
+    for (const auto &[event, tracks] : events)
+    {
+        const auto signalStart = Clock::now();
+        if (settings.mode == "arena")
+        {
+            const auto &arena = mixer.AddEventByValue(event,tracks);
+            result.signalPairs += arena.size();
+        }
+        else if (settings.mode == "visitor")
+        {
+            mixer.ForEachSignalPair(event,tracks,[&result](const PairKey &, const BenchPair &){++result.signalPairs;});
+        }
+        else
+        {
+            for (const auto &[key, pairs] : mixer.AddEvent(event,tracks))
+                result.signalPairs += pairs.size();
+        }
+        const auto backgroundStart = Clock::now();
+
+        if (settings.mode == "arena")
+        {
+            const auto &arena = mixer.GetSimilarPairsByValue(event);
+            result.backgroundPairs += arena.size();
+        }
+        else if (settings.mode == "visitor")
+        {
+            mixer.ForEachBackgroundPair(event,[&result](const PairKey &, const BenchPair &){++result.backgroundPairs;});
+        }
+        else
+        {
+            for (const auto &[key, pairs] : mixer.GetSimilarPairs(event))
+                result.backgroundPairs += pairs.size();
+        }
+        const auto backgroundEnd = Clock::now();
+
+        result.signalSeconds += std::chrono::duration<double>(backgroundStart - signalStart).count();
+        result.backgroundSeconds += std::chrono::duration<double>(backgroundEnd - backgroundStart).count();
+    }
+
+    if (settings.counters)
+    {
+        mixer.PrintCounters();
+        mixer.PrintStatus();
+    }
+
+    return result;
+}
+
+BenchResult RunStaticBenchmark(const BenchSettings &settings, const std::vector<GeneratedEvent> &events)
+{
+    const double cutFraction = settings.cutFraction;
+    auto mixer = Mixing::MakeStaticMixer<BenchEvent,BenchTrack,BenchPair>([](const BenchEvent &event){return event.eventClass;},
+                                                                          Mixing::NoPairHashing(),
+                                                                          [cutFraction](const BenchPair &pair){return pair.random < cutFraction;});
+    ConfigureMixer(mixer,settings);
+
+    const BenchResult result = RunPairMapLoop(mixer,events,0,1);
+    if (settings.counters)
+        mixer.PrintStatus();
+
+    return result;
+}
+
+BenchResult RunConcurrentBenchmark(const BenchSettings &settings, const std::vector<GeneratedEvent> &events)
+{
+    Mixing::JJFemtoMixerConcurrent<BenchEvent,BenchTrack,BenchPair,int,int> mixer(64,settings.nThreads);
+    ConfigureMixer(mixer,settings);
+    mixer.SetEventHashingFunction([](const std::shared_ptr<BenchEvent> &event){return event->eventClass;});
+
+    const double cutFraction = settings.cutFraction;
+    if (cutFraction > 0.)
+        mixer.SetPairCuttingFunction([cutFraction](const std::shared_ptr<BenchPair> &pair){return pair->random < cutFraction;});
+
+    // each thread takes every nThreads-th event
+    std::vector<BenchResult> threadResults(settings.nThreads);
+    std::vector<std::thread> threads;
+    for (std::size_t thread = 0; thread < settings.nThreads; ++thread)
+        threads.emplace_back([&mixer,&events,&threadResults,&settings,thread](){threadResults[thread] = RunPairMapLoop(mixer,events,thread,settings.nThreads);});
+    for (auto &thread : threads)
+        thread.join();
+
+    // the time of each stage is averaged over the threads, so the rates are the combined throughput of all threads
+    BenchResult result;
+    for (const auto &threadResult : threadResults)
+    {
+        result.signalPairs += threadResult.signalPairs;
+        result.backgroundPairs += threadResult.backgroundPairs;
+        result.signalSeconds += threadResult.signalSeconds / settings.nThreads;
+        result.backgroundSeconds += threadResult.backgroundSeconds / settings.nThreads;
+    }
+
+    if (settings.counters)
+        mixer.PrintStatus();
+
+    return result;
+}
+
+void PrintUsage(const char *name)
+{
+    std::cout << "Usage: " << name << " [options]\n"
+              << "  --events N          number of generated events, at least 1 (default 10000)\n"
+              << "  --classes N         number of event classes (default 10)\n"
+              << "  --multiplicity N    mean number of tracks per event, at least 1 (default 50)\n"
+              << "  --distribution D    multiplicity distribution: fixed, poisson or flat (default poisson)\n"
+              << "  --buffer N          event buffer size (default 10)\n"
+              << "  --tracks-per-event N number of tracks buffered per event (default 1)\n"
+              << "  --budget N          memory budget of the mixing buffers in bytes, 0 is unlimited (default 0)\n"
+              << "  --cut F             fraction of pairs rejected by the pair cut (default 0)\n"
+              << "  --precut Q          reject pairs with qInv above Q by the pair pre-cut, 0 is no pre-cut (default 0)\n"
+              << "  --mode M            map, typed, arena, visitor, cache, static or concurrent (default map)\n"
+              << "  --threads N         threads adding events in the concurrent mode (default: hardware threads)\n"
+              << "  --counters          enable and print the mixer performance counters (the buffer status only for static and concurrent)\n";
+}
+
+int main(int argc, char **argv)
+{
+    BenchSettings settings;
+    for (int iter = 1; iter < argc; ++iter)
+    {
+        const std::string option = argv[iter];
+        const bool hasValue = iter + 1 < argc;
+        if (option == "--events" && hasValue)
+            settings.nEvents = std::atoi(argv[++iter]);
+        else if (option == "--classes" && hasValue)
+            settings.nClasses = std::max(1, std::atoi(argv[++iter]));
+        else if (option == "--multiplicity" && hasValue)
+            settings.multiplicity = std::atoi(argv[++iter]);
+        else if (option == "--distribution" && hasValue)
+            settings.distribution = argv[++iter];
+        else if (option == "--buffer" && hasValue)
+            settings.bufferSize = std::max(1, std::atoi(argv[++iter]));
+        else if (option == "--tracks-per-event" && hasValue)
+            settings.tracksPerEvent = std::max(1, std::atoi(argv[++iter]));
+        else if (option == "--budget" && hasValue)
+            settings.memoryBudget = std::strtoull(argv[++iter],nullptr,10);
+        else if (option == "--cut" && hasValue)
+            settings.cutFraction = std::atof(argv[++iter]);
+        else if (option == "--precut" && hasValue)
+            settings.preCutQinv = static_cast<float>(std::atof(argv[++iter]));
+        else if (option == "--mode" && hasValue)
+            settings.mode = argv[++iter];
+        else if (option == "--threads" && hasValue)
+            settings.nThreads = std::max(1, std::atoi(argv[++iter]));
+        else if (option == "--counters")
+            settings.counters = true;
+        else
+        {
+            PrintUsage(argv[0]);
+            return (option == "--help") ? 0 : 1;
+        }
+    }
+
+    // values which would make the run meaningless or undefined (the per-event rates divide by the number of events, the Poisson mean has to be positive)
+    const std::vector<std::string> modes = {"map","typed","arena","visitor","cache","static","concurrent"}, distributions = {"fixed","poisson","flat"};
+    std::string error;
+    if (std::find(modes.begin(),modes.end(),settings.mode) == modes.end())
+        error = "unknown mode " + settings.mode;
+    else if (std::find(distributions.begin(),distributions.end(),settings.distribution) == distributions.end())
+        error = "unknown distribution " + settings.distribution;
+    else if (settings.nEvents < 1)
+        error = "the number of events has to be positive";
+    else if (settings.multiplicity < 1)
+        error = "the multiplicity has to be positive";
+
+    if (! error.empty())
+    {
+        std::cerr << "Error: " << error << "\n";
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    const auto events = GenerateEvents(settings);
+    BenchResult result;
+    if (settings.mode == "static")
+        result = RunStaticBenchmark(settings,events);
+    else if (settings.mode == "concurrent")
+        result = RunConcurrentBenchmark(settings,events);
+    else if (settings.mode == "typed")
+        result = RunBenchmark<int,int>(settings,events);
+    else
+        result = RunBenchmark<std::string,std::string>(settings,events);
+
+    std::cout << "mode: " << settings.mode << "\tevents: " << settings.nEvents << "\tclasses: " << settings.nClasses
+              << "\tmultiplicity: " << settings.multiplicity << " (" << settings.distribution << ")\tbuffer: " << settings.bufferSize
+              << "\ttracks per event: " << settings.tracksPerEvent << "\tbudget: " << settings.memoryBudget
+              << "\tcut fraction: " << settings.cutFraction << "\tpre-cut qInv: " << settings.preCutQinv;
+    if (settings.mode == "concurrent")
+        std::cout << "\tthreads: " << settings.nThreads;
+    std::cout << "\n";
+    std::cout << "AddEvent:        " << settings.nEvents / result.signalSeconds << " events/s\t" << result.signalPairs / result.signalSeconds << " pairs/s\n";
+    std::cout << "GetSimilarPairs: " << settings.nEvents / result.backgroundSeconds << " events/s\t" << result.backgroundPairs / result.backgroundSeconds << " pairs/s\n";
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file TestObjects.hxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Objects and checks shared by the test programs
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef TestObjects_hxx
+    #define TestObjects_hxx
+
+    #include <vector>
+    #include <memory>
+    #include <iostream>
+    #include <string>
+    #include <map>
+    #include <tuple>
+    #include "../JJTrackSoA.hxx"
+
+    // the track remembers the event and the class it came from, so that the tests can see where the tracks of a pair belong
+    struct TestTrack
+    {
+        float px,py,pz,e;
+        long eventId;
+        int eventClass;
+    };
+
+    struct TestEvent
+    {
+        long id;
+        int eventClass;
+        long GetID() const noexcept {return id;}
+    };
+
+    struct TestPair
+    {
+        std::shared_ptr<TestTrack> trck1,trck2;
+        TestPair(const std::shared_ptr<TestTrack> &first, const std::shared_ptr<TestTrack> &second) : trck1(first), trck2(second) {}
+    };
+
+    template<> struct Mixing::TrackKinematics<TestTrack>
+    {
+        static float Px(const TestTrack &track) {return track.px;}
+        static float Py(const TestTrack &track) {return track.py;}
+        static float Pz(const TestTrack &track) {return track.pz;}
+        static float E(const TestTrack &track) {return track.e;}
+    };
+
+    namespace Test
+    {
+        inline int failures = 0;
+
+        /**
+         * @brief Create the tracks of an event, the momenta depend on the event ID and the track index
+         *
+         * @param event event the tracks belong to
+         * @param nTracks number of tracks
+         * @return std::vector<std::shared_ptr<TestTrack> >
+         */
+        inline std::vector<std::shared_ptr<TestTrack> > MakeTracks(const TestEvent &event, std::size_t nTracks)
+        {
+            std::vector<std::shared_ptr<TestTrack> > tracks;
+            for (std::size_t track = 0; track < nTracks; ++track)
+            {
+                const float value = static_cast<float>((event.id * 37 + static_cast<long>(track) * 11) % 97) / 97.f;
+                tracks.push_back(std::make_shared<TestTrack>(TestTrack{value,1.f - value,0.5f * value,2.f,event.id,event.eventClass}));
+            }
+
+            return tracks;
+        }
+
+        // pair written as (event and px of the first track, event and px of the second track), so that the order of the tracks counts
+        using PairList = std::vector<std::tuple<long,float,long,float> >;
+
+        /**
+         * @brief Convert the pairs returned by a mixer into plain values, keeping the order of the groups' pairs and of the tracks in each pair
+         *
+         * @tparam PairMap map from the pair hash to a vector of pair pointers
+         * @param pairMap pairs returned by the mixer
+         * @return std::map<typename PairMap::key_type,PairList>
+         */
+        template<typename PairMap>
+        std::map<typename PairMap::key_type,PairList> Flatten(const PairMap &pairMap)
+        {
+            std::map<typename PairMap::key_type,PairList> flat;
+            for (const auto &[key,pairs] : pairMap)
+                for (const auto &pair : pairs)
+                    flat[key].emplace_back(pair->trck1->eventId,pair->trck1->px,pair->trck2->eventId,pair->trck2->px);
+
+            return flat;
+        }
+
+        /**
+         * @brief Print the summary of a test program
+         *
+         * @param name name of the test program
+         * @return int exit code, 0 if all checks passed
+         */
+        inline int Report(const std::string &name)
+        {
+            if (failures == 0)
+            {
+                std::cout << name << ": all checks passed" << std::endl;
+                return 0;
+            }
+
+            std::cout << name << ": " << failures << " checks failed" << std::endl;
+            return 1;
+        }
+    }
+
+    // reports a failed condition and carries on, so that one run shows all failures
+    #define TEST_CHECK(condition) \
+        do { \
+            if (! (condition)) \
+            { \
+                std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #condition << std::endl; \
+                ++Test::failures; \
+            } \
+        } while (false)
+
+#endif
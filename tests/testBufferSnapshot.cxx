@@ -0,0 +1,254 @@
+/**
+ * @file testBufferSnapshot.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Checks of saving and loading the mixing buffers and of the validation of malformed snapshots
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJFemtoMixerConcurrent.hxx"
+
+#include "TestObjects.hxx"
+
+#include <sstream>
+#include <cstddef>
+#include <cstring>
+#include <random>
+
+template<> struct Mixing::TrackSerializer<TestTrack> : Mixing::TriviallyCopyableTrackSerializer<TestTrack> {};
+
+using Mixer = Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,std::string,int>;
+using Header = Mixing::Detail::SnapshotHeader;
+
+void Configure(Mixer &mixer, std::size_t bufferSize)
+{
+    mixer.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &event){return "class-" + std::to_string(event->eventClass);});
+    mixer.SetPairHashingFunction([](const std::shared_ptr<TestPair> &pair){return static_cast<int>(4.f * (pair->trck1->px + pair->trck2->px));});
+    mixer.SetMaxBufferSize(bufferSize);
+    mixer.SetTracksPerEvent(2);
+    mixer.SetSeed(4);
+}
+
+void Fill(Mixer &mixer)
+{
+    for (long evt = 0; evt < 30; ++evt)
+    {
+        const auto event = std::make_shared<TestEvent>(TestEvent{evt,static_cast<int>(evt % 3)});
+        (void)mixer.AddEvent(event,Test::MakeTracks(*event,2 + evt % 4));
+    }
+}
+
+// background of an event which is not buffered, for each class, i.e. all buffered tracks of the mixer
+template<typename AnyMixer>
+std::vector<std::map<int,Test::PairList> > Background(AnyMixer &mixer)
+{
+    std::vector<std::map<int,Test::PairList> > background;
+    for (int eventClass = 0; eventClass < 3; ++eventClass)
+        background.push_back(Test::Flatten(mixer.GetSimilarPairs(std::make_shared<TestEvent>(TestEvent{-1,eventClass}))));
+    return background;
+}
+
+std::string Save(const Mixer &mixer)
+{
+    std::ostringstream stream(std::ios::binary);
+    mixer.SaveBuffers(stream);
+    return stream.str();
+}
+
+template<typename Field>
+void SetField(std::string &data, std::size_t offset, Field value)
+{
+    std::memcpy(data.data() + offset,&value,sizeof(Field));
+}
+
+// a malformed snapshot has to be rejected with std::runtime_error, either by the view or by LoadBuffers, and leave the buffers of the mixer as they were
+bool IsRejected(const std::string &data, Mixer &mixer)
+{
+    const auto before = Background(mixer);
+    bool rejected = false;
+    try
+    {
+        mixer.LoadBuffers(Mixing::JJBufferSnapshotView(data.data(),data.size()));
+    }
+    catch (const std::runtime_error &)
+    {
+        rejected = true;
+    }
+
+    return rejected && Background(mixer) == before;
+}
+
+int main()
+{
+    Mixer original;
+    Configure(original,4);
+    Fill(original);
+    const std::string data = Save(original);
+
+    // round trip: the loaded buffers give the same pairs and are saved to the same bytes
+    {
+        Mixer loaded;
+        Configure(loaded,4);
+        loaded.LoadBuffers(Mixing::JJBufferSnapshotView(data.data(),data.size()));
+        TEST_CHECK(Background(loaded) == Background(original));
+        TEST_CHECK(Save(loaded) == data);
+
+        const Mixing::JJBufferSnapshotView view(data.data(),data.size());
+        TEST_CHECK(view.GetNClasses() == 3);
+        for (std::size_t evtClass = 0; evtClass < view.GetNClasses(); ++evtClass)
+            TEST_CHECK(view.GetNEntries(evtClass) == 4 && view.GetPopCounter(evtClass) == 6);
+    }
+
+    // the snapshot does not depend on the number of shards
+    {
+        Mixing::JJFemtoMixerConcurrent<TestEvent,TestTrack,TestPair,std::string,int> concurrent(7,2);
+        concurrent.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &event){return "class-" + std::to_string(event->eventClass);});
+        concurrent.SetPairHashingFunction([](const std::shared_ptr<TestPair> &pair){return static_cast<int>(4.f * (pair->trck1->px + pair->trck2->px));});
+        concurrent.SetMaxBufferSize(4);
+        concurrent.SetTracksPerEvent(2);
+        concurrent.LoadBuffers(Mixing::JJBufferSnapshotView(data.data(),data.size()));
+        TEST_CHECK(Background(concurrent) == Background(original));
+
+        std::ostringstream stream(std::ios::binary);
+        concurrent.SaveBuffers(stream);
+        const std::string concurrentData = stream.str();
+        Mixer reloaded;
+        Configure(reloaded,4);
+        reloaded.LoadBuffers(Mixing::JJBufferSnapshotView(concurrentData.data(),concurrentData.size()));
+        TEST_CHECK(Background(reloaded) == Background(original));
+    }
+
+    // a smaller buffer keeps the newest events, fewer tracks per event keep the first tracks
+    {
+        Mixer smaller;
+        Configure(smaller,2);
+        smaller.SetTracksPerEvent(1);
+        smaller.LoadBuffers(Mixing::JJBufferSnapshotView(data.data(),data.size()));
+
+        const std::string smallerData = Save(smaller);
+        const Mixing::JJBufferSnapshotView smallerView(smallerData.data(),smallerData.size());
+        const Mixing::JJBufferSnapshotView originalView(data.data(),data.size());
+        bool newest = true;
+        for (std::size_t evtClass = 0; evtClass < smallerView.GetNClasses(); ++evtClass)
+        {
+            newest &= (smallerView.GetNEntries(evtClass) == 2 && smallerView.GetPopCounter(evtClass) == 8);
+            for (std::size_t entry = 0; entry < 2; ++entry)
+                newest &= (smallerView.GetEventID(evtClass,entry) == originalView.GetEventID(evtClass,entry + 2) && smallerView.GetNTracks(evtClass,entry) == 1);
+        }
+        TEST_CHECK(newest);
+    }
+
+    // malformed snapshots
+    {
+        Mixer target;
+        Configure(target,4);
+        Fill(target);
+
+        // every truncation, trailing data and an empty input
+        bool allRejected = true;
+        for (std::size_t size = 0; size < data.size(); ++size)
+            allRejected &= IsRejected(data.substr(0,size),target);
+        TEST_CHECK(allRejected);
+        TEST_CHECK(IsRejected(data + '\0',target));
+
+        auto corrupted = [&data](auto &&modify)
+        {
+            std::string copy = data;
+            modify(copy);
+            return copy;
+        };
+        const std::size_t classTable = sizeof(Header), entryTable = classTable + 3 * sizeof(Mixing::Detail::SnapshotClassRecord);
+
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){copy[0] = 'X';}),target));
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint32_t>(copy,offsetof(Header,version),2);}),target));
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint32_t>(copy,offsetof(Header,byteOrder),0x04030201);}),target));
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint64_t>(copy,offsetof(Header,nClasses),4);}),target));
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint64_t>(copy,offsetof(Header,nClasses),~std::uint64_t(0));}),target));
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint64_t>(copy,offsetof(Header,nEntries),~std::uint64_t(0) / 8);}),target));
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint64_t>(copy,offsetof(Header,trackStride),0);}),target));
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint64_t>(copy,offsetof(Header,trackSize),4);}),target));
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint64_t>(copy,offsetof(Header,tracksOffset),0);}),target));
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint64_t>(copy,offsetof(Header,stringsOffset),~std::uint64_t(0));}),target));
+        TEST_CHECK(IsRejected(corrupted([classTable](std::string &copy){SetField<std::uint64_t>(copy,classTable + offsetof(Mixing::Detail::SnapshotClassRecord,firstEntry),11);}),target));
+        TEST_CHECK(IsRejected(corrupted([classTable](std::string &copy){SetField<std::uint64_t>(copy,classTable + offsetof(Mixing::Detail::SnapshotClassRecord,nEntries),~std::uint64_t(0));}),target));
+        TEST_CHECK(IsRejected(corrupted([classTable](std::string &copy){SetField<std::uint64_t>(copy,classTable + offsetof(Mixing::Detail::SnapshotClassRecord,keyOffset),~std::uint64_t(0) - 2);}),target));
+        TEST_CHECK(IsRejected(corrupted([classTable](std::string &copy){SetField<std::uint64_t>(copy,classTable + offsetof(Mixing::Detail::SnapshotClassRecord,keySize),1000);}),target));
+        TEST_CHECK(IsRejected(corrupted([entryTable](std::string &copy){SetField<std::uint64_t>(copy,entryTable + offsetof(Mixing::Detail::SnapshotEntryRecord,firstTrack),~std::uint64_t(0));}),target));
+        TEST_CHECK(IsRejected(corrupted([entryTable](std::string &copy){SetField<std::uint64_t>(copy,entryTable + offsetof(Mixing::Detail::SnapshotEntryRecord,nTracks),1000);}),target));
+
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint32_t>(copy,offsetof(Header,keyKind),7);}),target));
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint32_t>(copy,offsetof(Header,keySize),4);}),target));
+        TEST_CHECK(IsRejected(corrupted([](std::string &copy){SetField<std::uint32_t>(copy,offsetof(Header,keyKind),Mixing::Detail::SnapshotKeyIntegral);}),target));
+
+        // a mixer with a different key type, also when the string keys have the size of the other key type (class "cent" would be read as the int 1953391971)
+        auto loadsWithKeys = [](auto &&mixer, const std::string &snapshot)
+        {
+            const auto event = std::make_shared<TestEvent>(TestEvent{99,0});
+            (void)mixer.AddEvent(event,Test::MakeTracks(*event,2));
+            const auto before = Test::Flatten(mixer.GetSimilarPairs(std::make_shared<TestEvent>(TestEvent{-1,0})));
+            try
+            {
+                mixer.LoadBuffers(Mixing::JJBufferSnapshotView(snapshot.data(),snapshot.size()));
+            }
+            catch (const std::runtime_error &)
+            {
+                return Test::Flatten(mixer.GetSimilarPairs(std::make_shared<TestEvent>(TestEvent{-1,0}))) != before;
+            }
+            return true;
+        };
+
+        Mixer centrality;
+        Configure(centrality,4);
+        centrality.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &){return std::string("cent");});
+        Fill(centrality);
+        const std::string centralityData = Save(centrality);
+
+        Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,int,int> intKeys;
+        intKeys.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &){return 1953391971;});
+        intKeys.SetMaxBufferSize(4);
+        TEST_CHECK(! loadsWithKeys(intKeys,centralityData));
+        TEST_CHECK(! loadsWithKeys(intKeys,data));
+
+        Mixing::JJFemtoMixerConcurrent<TestEvent,TestTrack,TestPair,int,int> concurrentIntKeys(4,1);
+        concurrentIntKeys.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &){return 1953391971;});
+        concurrentIntKeys.SetMaxBufferSize(4);
+        TEST_CHECK(! loadsWithKeys(concurrentIntKeys,centralityData));
+
+        // and the other way round, and keys of the same kind but another size
+        std::ostringstream intStream(std::ios::binary);
+        intKeys.SaveBuffers(intStream);
+        Mixer stringKeys;
+        Configure(stringKeys,4);
+        TEST_CHECK(! loadsWithKeys(stringKeys,intStream.str()));
+
+        Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,long,int> longKeys;
+        longKeys.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &){return 0L;});
+        longKeys.SetMaxBufferSize(4);
+        TEST_CHECK(! loadsWithKeys(longKeys,intStream.str()));
+
+        // random bit flips have to be either rejected or loaded, never read out of bounds (run with -fsanitize=address)
+        std::mt19937 generator(13);
+        std::uniform_int_distribution<std::size_t> byteDist(0,data.size() - 1);
+        std::uniform_int_distribution<int> bitDist(0,7);
+        for (int flip = 0; flip < 2000; ++flip)
+        {
+            std::string copy = data;
+            copy[byteDist(generator)] ^= static_cast<char>(1 << bitDist(generator));
+            try
+            {
+                Mixer mixer;
+                Configure(mixer,4);
+                mixer.LoadBuffers(Mixing::JJBufferSnapshotView(copy.data(),copy.size()));
+                (void)Background(mixer);
+            }
+            catch (const std::runtime_error &)
+            {
+            }
+        }
+    }
+
+    return Test::Report("testBufferSnapshot");
+}
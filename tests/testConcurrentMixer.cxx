@@ -0,0 +1,147 @@
+/**
+ * @file testConcurrentMixer.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Checks of JJUtils::TaskPool and of the results of JJFemtoMixerConcurrent against the serial JJFemtoMixer
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJFemtoMixerConcurrent.hxx"
+
+#include "TestObjects.hxx"
+
+#include <thread>
+#include <atomic>
+
+using Serial = Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,int,int>;
+using Concurrent = Mixing::JJFemtoMixerConcurrent<TestEvent,TestTrack,TestPair,int,int>;
+
+// every item of a loop has to be run exactly once, also when several threads run loops on the same pool
+void CheckTaskPool(std::size_t nThreads)
+{
+    JJUtils::TaskPool pool(nThreads);
+    TEST_CHECK(pool.GetNThreads() == std::max<std::size_t>(nThreads,1));
+
+    for (std::size_t nItems : {0,1,2,7,1000})
+    {
+        std::vector<std::atomic<int> > calls(nItems);
+        pool.ParallelFor(nItems,[&calls](std::size_t item){calls[item].fetch_add(1);});
+
+        bool once = true;
+        for (const auto &call : calls)
+            once &= (call.load() == 1);
+        TEST_CHECK(once);
+    }
+
+    std::vector<std::atomic<int> > calls(4 * 500);
+    std::vector<std::thread> callers;
+    for (std::size_t caller = 0; caller < 4; ++caller)
+        callers.emplace_back([&pool,&calls,caller](){pool.ParallelFor(500,[&calls,caller](std::size_t item){calls[caller * 500 + item].fetch_add(1);});});
+    for (auto &caller : callers)
+        caller.join();
+
+    bool once = true;
+    for (const auto &call : calls)
+        once &= (call.load() == 1);
+    TEST_CHECK(once);
+}
+
+template<typename Mixer>
+void Configure(Mixer &mixer, std::size_t tracksPerEvent, bool preCut, bool cache)
+{
+    mixer.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &event){return event->eventClass;});
+    mixer.SetPairHashingFunction([](const std::shared_ptr<TestPair> &pair){return static_cast<int>(4.f * (pair->trck1->px + pair->trck2->px));});
+    mixer.SetPairCuttingFunction([](const std::shared_ptr<TestPair> &pair){return pair->trck1->py > 0.9f;});
+    mixer.SetMaxBufferSize(5);
+    mixer.SetTracksPerEvent(tracksPerEvent);
+    mixer.SetSeed(11);
+    if (preCut)
+    {
+        Mixing::JJPairPreCut cut;
+        cut.maxQinv = 0.6f;
+        mixer.SetPairPreCut(cut);
+    }
+    mixer.SetBackgroundPairCaching(cache);
+}
+
+// the concurrent mixer (serial and parallel pair building, with and without the cache) has to return exactly the pairs of JJFemtoMixer, in the same order
+void CheckSameAsSerial(std::size_t tracksPerEvent, bool preCut, bool cache)
+{
+    Serial serial;
+    Configure(serial,tracksPerEvent,preCut,cache);
+    Concurrent parallel(8,4), oneThread(1,1);
+    Configure(parallel,tracksPerEvent,preCut,cache);
+    Configure(oneThread,tracksPerEvent,preCut,cache);
+    parallel.SetParallelThreshold(2);
+
+    bool same = true;
+    for (long evt = 0; evt < 60; ++evt)
+    {
+        const auto event = std::make_shared<TestEvent>(TestEvent{evt,static_cast<int>(evt % 4)});
+        const auto tracks = Test::MakeTracks(*event,10 + evt % 7);
+
+        const auto signal = Test::Flatten(serial.AddEvent(event,tracks));
+        same &= (Test::Flatten(parallel.AddEvent(event,tracks)) == signal);
+        same &= (Test::Flatten(oneThread.AddEvent(event,tracks)) == signal);
+
+        const auto background = Test::Flatten(serial.GetSimilarPairs(event));
+        same &= (Test::Flatten(parallel.GetSimilarPairs(event)) == background);
+        same &= (Test::Flatten(oneThread.GetSimilarPairs(event)) == background);
+    }
+
+    TEST_CHECK(same);
+}
+
+// the buffered tracks depend only on the seed and on the events of each class, not on the number of shards or on how the classes interleave
+void CheckSeedReproducibility()
+{
+    auto run = [](std::size_t nShards, bool interleave, std::uint_fast32_t seed)
+    {
+        Concurrent mixer(nShards,2);
+        Configure(mixer,2,false,false);
+        mixer.SetSeed(seed);
+
+        // each class gets its events in the same order, only the order between the classes differs
+        std::vector<TestEvent> events;
+        for (int eventClass = 0; eventClass < 3; ++eventClass)
+            for (long evt = 0; evt < 8; ++evt)
+                events.push_back(TestEvent{eventClass * 100 + evt,eventClass});
+        if (interleave)
+            std::stable_sort(events.begin(),events.end(),[](const TestEvent &first, const TestEvent &second){return first.id % 100 < second.id % 100;});
+
+        for (const auto &event : events)
+        {
+            const auto eventPtr = std::make_shared<TestEvent>(event);
+            (void)mixer.AddEvent(eventPtr,Test::MakeTracks(event,6));
+        }
+
+        std::vector<std::map<int,Test::PairList> > background;
+        for (int eventClass = 0; eventClass < 3; ++eventClass)
+            background.push_back(Test::Flatten(mixer.GetSimilarPairs(std::make_shared<TestEvent>(TestEvent{-1,eventClass}))));
+        return background;
+    };
+
+    const auto reference = run(1,false,5);
+    TEST_CHECK(run(16,false,5) == reference);
+    TEST_CHECK(run(3,true,5) == reference);
+    TEST_CHECK(run(1,true,5) == reference);
+    TEST_CHECK(run(1,false,6) != reference);
+}
+
+int main()
+{
+    for (std::size_t nThreads : {0,1,2,4})
+        CheckTaskPool(nThreads);
+
+    for (std::size_t tracksPerEvent : {1,3})
+        for (bool preCut : {false,true})
+            for (bool cache : {false,true})
+                CheckSameAsSerial(tracksPerEvent,preCut,cache);
+
+    CheckSeedReproducibility();
+
+    return Test::Report("testConcurrentMixer");
+}
@@ -0,0 +1,81 @@
+/**
+ * @file testConcurrentStress.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Several threads add events to JJFemtoMixerConcurrent and read the background pairs, while the buffer entries are constantly overwritten
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJFemtoMixerConcurrent.hxx"
+
+#include "TestObjects.hxx"
+
+#include <thread>
+#include <atomic>
+
+// the tracks of a pair have to be intact and come from other events of the same class
+bool IsValidBackgroundPair(const TestPair &pair, const TestEvent &event)
+{
+    for (const auto &trck : {pair.trck1,pair.trck2})
+    {
+        if (trck->eventClass != event.eventClass || trck->eventId == event.id)
+            return false;
+        if (trck->px + trck->py != 1.f || trck->pz != 0.5f * trck->px || trck->e != 2.f)
+            return false;
+    }
+
+    return pair.trck1->eventId != pair.trck2->eventId;
+}
+
+int main()
+{
+    constexpr int nThreads = 8, nEventsPerThread = 2000, nClasses = 5;
+    constexpr std::size_t nTracks = 6;
+
+    // few shards and small buffers, so that the threads share the shards and the entries are overwritten all the time
+    Mixing::JJFemtoMixerConcurrent<TestEvent,TestTrack,TestPair,int,int> mixer(2,4);
+    mixer.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &event){return event->eventClass;});
+    mixer.SetMaxBufferSize(3);
+    mixer.SetTracksPerEvent(2);
+    mixer.SetParallelThreshold(4);
+
+    std::atomic<int> badPairs(0), badSignal(0);
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < nThreads; ++thread)
+    {
+        threads.emplace_back([&mixer,&badPairs,&badSignal,thread]()
+        {
+            // the previous background pairs are kept for a while, so some of the overwritten entries are still referenced
+            Mixing::JJFemtoMixerConcurrent<TestEvent,TestTrack,TestPair,int,int>::PairMap previous;
+            for (int evt = 0; evt < nEventsPerThread; ++evt)
+            {
+                const auto event = std::make_shared<TestEvent>(TestEvent{thread * nEventsPerThread + evt,(thread + evt) % nClasses});
+                std::size_t nSignal = 0;
+                for (const auto &[key,pairs] : mixer.AddEvent(event,Test::MakeTracks(*event,nTracks)))
+                    nSignal += pairs.size();
+                if (nSignal != nTracks * (nTracks - 1) / 2)
+                    ++badSignal;
+
+                auto background = mixer.GetSimilarPairs(event);
+                for (const auto &[key,pairs] : background)
+                    for (const auto &pair : pairs)
+                        if (! IsValidBackgroundPair(*pair,*event))
+                            ++badPairs;
+
+                if (evt % 3 == 0)
+                    previous = std::move(background);
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    TEST_CHECK(badSignal.load() == 0);
+    TEST_CHECK(badPairs.load() == 0);
+
+    return Test::Report("testConcurrentStress");
+}
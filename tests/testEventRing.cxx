@@ -0,0 +1,282 @@
+/**
+ * @file testEventRing.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Checks of Mixing::JJEventRing (wrap-around, SetCapacity, storage reuse), of the memory budget of the mixers and of copying the mixers
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJFemtoMixerConcurrent.hxx"
+
+#include "../JJFemtoMixerStatic.hxx"
+
+#include "TestObjects.hxx"
+
+using Ring = Mixing::JJEventRing<int>;
+
+// event IDs from the oldest to the newest, the single track of each event holds the ID too
+std::vector<std::uint64_t> Content(const Ring &ring)
+{
+    std::vector<std::uint64_t> ids;
+    for (std::size_t entry = 0; entry < ring.size(); ++entry)
+    {
+        const bool intact = (ring[entry].tracks->size() == 1 && *ring.GetTrack(entry,0) == static_cast<int>(ring[entry].eventId));
+        ids.push_back(intact ? ring[entry].eventId : 0);
+    }
+    return ids;
+}
+
+void Push(Ring &ring, std::uint64_t first, std::uint64_t last)
+{
+    for (std::uint64_t id = first; id <= last; ++id)
+        ring.Push(id).push_back(static_cast<int>(id));
+}
+
+void CheckRing()
+{
+    // filling and wrapping around several times
+    Ring ring(3);
+    TEST_CHECK(ring.empty() && ! ring.full() && ring.capacity() == 3);
+    Push(ring,1,2);
+    TEST_CHECK(ring.size() == 2 && ! ring.full() && Content(ring) == (std::vector<std::uint64_t>{1,2}));
+    Push(ring,3,3);
+    TEST_CHECK(ring.full() && Content(ring) == (std::vector<std::uint64_t>{1,2,3}));
+    Push(ring,4,8);
+    TEST_CHECK(ring.size() == 3 && Content(ring) == (std::vector<std::uint64_t>{6,7,8}));
+
+    // growing a wrapped ring keeps the order, the new slots are filled next
+    TEST_CHECK(ring.SetCapacity(5) == 0);
+    TEST_CHECK(ring.size() == 3 && ! ring.full() && Content(ring) == (std::vector<std::uint64_t>{6,7,8}));
+    Push(ring,9,11);
+    TEST_CHECK(ring.full() && Content(ring) == (std::vector<std::uint64_t>{7,8,9,10,11}));
+
+    // shrinking keeps the newest events
+    TEST_CHECK(ring.SetCapacity(2) == 3);
+    TEST_CHECK(ring.full() && Content(ring) == (std::vector<std::uint64_t>{10,11}));
+    Push(ring,12,12);
+    TEST_CHECK(Content(ring) == (std::vector<std::uint64_t>{11,12}));
+
+    // capacity 0 stores nothing and is always full
+    TEST_CHECK(ring.SetCapacity(0) == 2);
+    TEST_CHECK(ring.empty() && ring.full() && ring.capacity() == 0);
+    TEST_CHECK(ring.SetCapacity(2) == 0);
+    Push(ring,13,15);
+    TEST_CHECK(Content(ring) == (std::vector<std::uint64_t>{14,15}));
+
+    ring.clear();
+    TEST_CHECK(ring.empty() && ring.capacity() == 2);
+    Push(ring,16,16);
+    TEST_CHECK(Content(ring) == (std::vector<std::uint64_t>{16}));
+}
+
+void CheckStorageReuse()
+{
+    Ring reusing(2), fresh(2,false);
+    Push(reusing,1,2);
+    Push(fresh,1,2);
+
+    // an overwritten slot reuses its storage unless the tracks are still referenced (a weak pointer does not count as a reference)
+    std::weak_ptr<Ring::TrackBlock> oldStorage = reusing[0].tracks;
+    Push(reusing,3,3);
+    TEST_CHECK(! oldStorage.expired() && oldStorage.lock() == reusing[1].tracks);
+
+    const std::shared_ptr<int> held = reusing.GetTrack(0,0);
+    Push(reusing,4,4);
+    TEST_CHECK(*held == 2 && reusing[1].tracks->data() != held.get());
+    TEST_CHECK(Content(reusing) == (std::vector<std::uint64_t>{3,4}));
+
+    // without the reuse every Push gets new storage, the old one is released unless referenced
+    const std::shared_ptr<int> oldTrack = fresh.GetTrack(0,0);
+    std::weak_ptr<Ring::TrackBlock> freshStorage = fresh[1].tracks;
+    Push(fresh,3,4);
+    TEST_CHECK(*oldTrack == 1 && fresh[0].tracks->data() != oldTrack.get() && freshStorage.expired());
+    TEST_CHECK(Content(fresh) == (std::vector<std::uint64_t>{3,4}));
+}
+
+template<typename Mixer>
+void Configure(Mixer &mixer)
+{
+    mixer.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &event){return event->eventClass;});
+    mixer.SetMaxBufferSize(2);
+    mixer.SetTracksPerEvent(2);
+}
+
+struct ClassHashing
+{
+    int operator()(const TestEvent &event) const noexcept {return event.eventClass;}
+};
+
+using StaticMixer = Mixing::JJFemtoMixerStatic<TestEvent,TestTrack,TestPair,ClassHashing>;
+
+void Configure(StaticMixer &mixer)
+{
+    mixer.SetMaxBufferSize(2);
+    mixer.SetTracksPerEvent(2);
+}
+
+template<typename Mixer>
+void AddEvent(Mixer &mixer, long id, int eventClass)
+{
+    const auto event = std::make_shared<TestEvent>(TestEvent{id,eventClass});
+    (void)mixer.AddEvent(event,Test::MakeTracks(*event,3));
+}
+
+template<typename Mixer>
+bool HasBackground(Mixer &mixer, int eventClass)
+{
+    return ! mixer.GetSimilarPairs(std::make_shared<TestEvent>(TestEvent{-1,eventClass})).empty();
+}
+
+void CheckBufferSizeZero()
+{
+    Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,int,int> mixer;
+    Configure(mixer);
+    mixer.SetMaxBufferSize(0);
+
+    const auto event = std::make_shared<TestEvent>(TestEvent{1,0});
+    std::size_t nSignal = 0;
+    for (const auto &[key,pairs] : mixer.AddEvent(event,Test::MakeTracks(*event,4)))
+        nSignal += pairs.size();
+    AddEvent(mixer,2,0);
+    TEST_CHECK(nSignal == 6 && ! HasBackground(mixer,0));
+}
+
+void CheckMemoryBudget()
+{
+    // the least recently filled class is evicted, the class of the current event never is
+    {
+        Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,int,int> mixer;
+        Configure(mixer);
+        for (int eventClass = 0; eventClass < 3; ++eventClass)
+            for (long evt = 0; evt < 2; ++evt)
+                AddEvent(mixer,eventClass * 10 + evt,eventClass);
+
+        const std::size_t threeClasses = mixer.GetMemoryUsage();
+        mixer.SetMemoryBudget(threeClasses);
+        TEST_CHECK(mixer.GetNEvictedClasses() == 0);
+
+        AddEvent(mixer,100,0);
+        AddEvent(mixer,101,3);
+        TEST_CHECK(mixer.GetNEvictedClasses() == 1 && mixer.GetMemoryUsage() <= threeClasses);
+        TEST_CHECK(HasBackground(mixer,0) && ! HasBackground(mixer,1) && HasBackground(mixer,2));
+
+        mixer.SetMemoryBudget(1);
+        TEST_CHECK(mixer.GetNEvictedClasses() == 3 && mixer.GetMemoryUsage() > 0);
+        AddEvent(mixer,102,3);
+        TEST_CHECK(HasBackground(mixer,3));
+    }
+
+    // the background pair cache counts too
+    {
+        Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,int,int> mixer;
+        Configure(mixer);
+        for (long evt = 0; evt < 4; ++evt)
+            AddEvent(mixer,evt,0);
+        const std::size_t withoutCache = mixer.GetMemoryUsage();
+        mixer.SetBackgroundPairCaching(true);
+        const std::size_t withCache = mixer.GetMemoryUsage();
+        TEST_CHECK(withCache > withoutCache);
+
+        for (long evt = 4; evt < 10; ++evt)
+            AddEvent(mixer,evt,0);
+        TEST_CHECK(mixer.GetMemoryUsage() == withCache);
+
+        mixer.SetMemoryBudget(withCache);
+        AddEvent(mixer,10,1);
+        AddEvent(mixer,11,1);
+        TEST_CHECK(mixer.GetNEvictedClasses() == 1 && ! HasBackground(mixer,0) && mixer.GetMemoryUsage() <= withCache);
+
+        mixer.SetBackgroundPairCaching(false);
+        TEST_CHECK(mixer.GetMemoryUsage() == withoutCache);
+    }
+
+    // JJFemtoMixerConcurrent shares one budget between the shards: the oldest class of the whole mixer goes, whichever shard it is in
+    {
+        Mixing::JJFemtoMixerConcurrent<TestEvent,TestTrack,TestPair,int,int> mixer(16,2);
+        Configure(mixer);
+        mixer.SetBackgroundPairCaching(true);
+        for (int eventClass = 0; eventClass < 4; ++eventClass)
+            for (long evt = 0; evt < 2; ++evt)
+                AddEvent(mixer,eventClass * 10 + evt,eventClass);
+
+        const std::size_t fourClasses = mixer.GetMemoryUsage();
+        mixer.SetMemoryBudget(fourClasses);
+        AddEvent(mixer,100,0);
+        AddEvent(mixer,101,4);
+        AddEvent(mixer,102,4);
+        TEST_CHECK(mixer.GetNEvictedClasses() == 1 && mixer.GetMemoryUsage() <= fourClasses);
+        TEST_CHECK(HasBackground(mixer,0) && ! HasBackground(mixer,1) && HasBackground(mixer,2) && HasBackground(mixer,3) && HasBackground(mixer,4));
+    }
+}
+
+// all buffered pairs of each class, i.e. the background of an event which is not buffered
+template<typename Mixer>
+std::vector<std::map<typename Mixer::PairMap::key_type,Test::PairList> > Background(Mixer &mixer)
+{
+    std::vector<std::map<typename Mixer::PairMap::key_type,Test::PairList> > background;
+    for (int eventClass = 0; eventClass < 4; ++eventClass)
+        background.push_back(Test::Flatten(mixer.GetSimilarPairs(std::make_shared<TestEvent>(TestEvent{-1,eventClass}))));
+    return background;
+}
+
+// a copy (or a moved mixer) has to work on its own after the original is gone, including the order in which the classes are evicted
+template<typename Mixer>
+void CheckCopyAndMove()
+{
+    auto fill = [](Mixer &mixer)
+    {
+        for (int eventClass = 0; eventClass < 3; ++eventClass)
+            for (long evt = 0; evt < 2; ++evt)
+                AddEvent(mixer,eventClass * 10 + evt,eventClass);
+    };
+    // refills the oldest class, then a new class has to evict class 1, the least recently filled one
+    auto carryOn = [](Mixer &mixer, std::size_t budget)
+    {
+        AddEvent(mixer,100,0);
+        mixer.SetMemoryBudget(budget);
+        AddEvent(mixer,101,3);
+        AddEvent(mixer,102,3);
+    };
+
+    Mixer reference;
+    Configure(reference);
+    reference.SetSeed(3);
+    fill(reference);
+    const std::size_t budget = reference.GetMemoryUsage();
+    carryOn(reference,budget);
+    const auto expected = Background(reference);
+    TEST_CHECK(! expected[0].empty() && expected[1].empty() && ! expected[2].empty() && ! expected[3].empty());
+
+    auto original = std::make_unique<Mixer>();
+    Configure(*original);
+    original->SetSeed(3);
+    fill(*original);
+    Mixer copied(*original), assigned, moveAssigned;
+    assigned = *original;
+    Mixer moved(std::move(*original));
+    original.reset();
+
+    Mixer source(moved);
+    moveAssigned = std::move(source);
+
+    for (Mixer *mixer : {&copied,&assigned,&moved,&moveAssigned})
+    {
+        carryOn(*mixer,budget);
+        TEST_CHECK(Background(*mixer) == expected);
+    }
+}
+
+int main()
+{
+    CheckRing();
+    CheckStorageReuse();
+    CheckBufferSizeZero();
+    CheckMemoryBudget();
+    CheckCopyAndMove<Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,int,int> >();
+    CheckCopyAndMove<StaticMixer>();
+
+    return Test::Report("testEventRing");
+}
@@ -0,0 +1,183 @@
+/**
+ * @file testFlatHashMap.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Checks of JJUtils::FlatHashMap against std::unordered_map, with the focus on the backward-shift erase
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJFlatHashMap.hxx"
+
+#include "TestObjects.hxx"
+
+#include <algorithm>
+#include <unordered_map>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// as in std::map, a key cannot be changed through an iterator behind the back of the index table
+static_assert(std::is_same<JJUtils::FlatHashMap<int,int>::value_type,std::pair<const int,int> >::value);
+static_assert(std::is_const<std::remove_reference_t<decltype(std::declval<JJUtils::FlatHashMap<int,int>::iterator>()->first)> >::value);
+
+// poor hashes put many keys into the same probe chain, which is where the backward shift has work to do
+struct ConstantHash
+{
+    std::size_t operator()(int) const noexcept {return 0;}
+};
+
+struct FewBucketsHash
+{
+    std::size_t operator()(int key) const noexcept {return static_cast<std::size_t>(key % 3);}
+};
+
+// every key of the reference has to be found with the right value and the entries must not contain anything else
+template<typename Map>
+bool SameContent(const Map &map, const std::unordered_map<int,int> &reference)
+{
+    if (map.size() != reference.size())
+        return false;
+
+    for (const auto &[key,value] : reference)
+    {
+        const auto iter = map.find(key);
+        if (iter == map.end() || iter->first != key || iter->second != value)
+            return false;
+    }
+
+    std::size_t nEntries = 0;
+    for (const auto &[key,value] : map)
+    {
+        const auto iter = reference.find(key);
+        if (iter == reference.end() || iter->second != value)
+            return false;
+        ++nEntries;
+    }
+
+    return nEntries == reference.size();
+}
+
+// the entries have to come in the order of insertion, also after erasing some of them
+template<typename Map>
+bool SameOrder(const Map &map, const std::vector<int> &order)
+{
+    return std::equal(map.begin(),map.end(),order.begin(),order.end(),[](const auto &entry, int key){return entry.first == key;});
+}
+
+// random inserts and erases on a small key range, so that the same keys are erased and inserted again many times
+template<typename Hash>
+void CheckRandomOperations(unsigned seed)
+{
+    JJUtils::FlatHashMap<int,int,Hash> map;
+    std::unordered_map<int,int> reference;
+    std::vector<int> order;
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<int> keyDist(0,40), operationDist(0,2);
+
+    bool consistent = true;
+    for (int step = 0; step < 20000 && consistent; ++step)
+    {
+        const int key = keyDist(generator);
+        if (operationDist(generator) == 0)
+        {
+            const std::size_t expected = reference.erase(key);
+            consistent &= (map.erase(key) == expected);
+            order.erase(std::remove(order.begin(),order.end(),key),order.end());
+        }
+        else
+        {
+            const bool expected = reference.try_emplace(key,step).second;
+            consistent &= (map.try_emplace(key,step).second == expected);
+            if (expected)
+                order.push_back(key);
+        }
+
+        consistent &= SameContent(map,reference) && SameOrder(map,order);
+    }
+
+    TEST_CHECK(consistent);
+}
+
+int main()
+{
+    // erase from the middle of a chain, the following keys have to stay reachable
+    {
+        JJUtils::FlatHashMap<int,int,ConstantHash> map;
+        for (int key = 0; key < 10; ++key)
+            map[key] = key * key;
+
+        TEST_CHECK(map.erase(3) == 1);
+        TEST_CHECK(map.erase(3) == 0);
+        TEST_CHECK(map.count(3) == 0);
+        TEST_CHECK(map.size() == 9);
+        for (int key = 0; key < 10; ++key)
+            if (key != 3)
+                TEST_CHECK(map.count(key) == 1 && map.at(key) == key * key);
+
+        // erasing the last entry and the first one
+        TEST_CHECK(map.erase(9) == 1 && map.erase(0) == 1);
+        TEST_CHECK(map.size() == 7 && map.count(8) == 1 && map.at(8) == 64);
+        TEST_CHECK(SameOrder(map,{1,2,4,5,6,7,8}));
+
+        // a copy assigned over a map with other entries gets the same entries, order and lookups
+        JJUtils::FlatHashMap<int,int,ConstantHash> copy;
+        copy[20] = 1;
+        copy = map;
+        TEST_CHECK(SameOrder(copy,{1,2,4,5,6,7,8}) && copy.count(20) == 0 && copy.at(5) == 25);
+    }
+
+    // the chain wraps around the end of the slot table (a constant hash always starts at the same slot, the table has 16 slots)
+    {
+        JJUtils::FlatHashMap<int,int,ConstantHash> map;
+        for (int key = 0; key < 7; ++key)
+            map[key] = key;
+        std::unordered_map<int,int> reference;
+        for (int key = 0; key < 7; ++key)
+            reference[key] = key;
+
+        for (int key : {0,4,2,6})
+        {
+            map.erase(key);
+            reference.erase(key);
+            TEST_CHECK(SameContent(map,reference));
+        }
+    }
+
+    // erased keys can be inserted again, the map can be emptied and reused
+    {
+        JJUtils::FlatHashMap<std::string,int> map;
+        for (int key = 0; key < 100; ++key)
+            map[std::to_string(key)] = key;
+        for (int key = 0; key < 100; key += 2)
+            TEST_CHECK(map.erase(std::to_string(key)) == 1);
+        TEST_CHECK(map.size() == 50);
+        for (int key = 0; key < 100; key += 2)
+            map[std::to_string(key)] = -key;
+        TEST_CHECK(map.size() == 100 && map.at("42") == -42 && map.at("43") == 43);
+
+        for (int key = 0; key < 100; ++key)
+            map.erase(std::to_string(key));
+        TEST_CHECK(map.empty() && map.begin() == map.end() && map.find("1") == map.end());
+
+        bool thrown = false;
+        try
+        {
+            (void)map.at("1");
+        }
+        catch (const std::out_of_range &)
+        {
+            thrown = true;
+        }
+        TEST_CHECK(thrown);
+    }
+
+    CheckRandomOperations<ConstantHash>(1);
+    CheckRandomOperations<FewBucketsHash>(2);
+    CheckRandomOperations<std::hash<int> >(3);
+
+    return Test::Report("testFlatHashMap");
+}
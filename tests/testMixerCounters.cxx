@@ -0,0 +1,130 @@
+/**
+ * @file testMixerCounters.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Checks of the performance counters of JJFemtoMixer on a small input with known pairs
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJFemtoMixer.hxx"
+
+#include "TestObjects.hxx"
+
+using Mixer = Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,int,int>;
+
+// tracks along x with the same energy, so that qInv of a pair is the difference of the px values
+std::vector<std::shared_ptr<TestTrack> > MakeTracks(long eventId, const std::vector<float> &pxValues)
+{
+    std::vector<std::shared_ptr<TestTrack> > tracks;
+    for (const float px : pxValues)
+        tracks.push_back(std::make_shared<TestTrack>(TestTrack{px,0.f,0.f,1.f,eventId,0}));
+
+    return tracks;
+}
+
+void Configure(Mixer &mixer, bool preCut)
+{
+    mixer.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &){return 0;});
+    // groups by the sum of px (symmetric, so the order of the tracks in a pair does not matter), pairs with the sum above 0.875 are cut
+    mixer.SetPairHashingFunction([](const std::shared_ptr<TestPair> &pair){return static_cast<int>(4.f * (pair->trck1->px + pair->trck2->px));});
+    mixer.SetPairCuttingFunction([](const std::shared_ptr<TestPair> &pair){return pair->trck1->px + pair->trck2->px > 0.875f;});
+    mixer.SetMaxBufferSize(2);
+    mixer.SetTracksPerEvent(10);
+    mixer.SetSeed(1);
+    if (preCut)
+    {
+        Mixing::JJPairPreCut cut;
+        cut.maxQinv = 0.3f;
+        mixer.SetPairPreCut(cut);
+    }
+}
+
+/**
+ * @brief Add two events and ask for the background of a third one
+ * Signal, px {0.1, 0.2, 0.35, 0.6}: sums 0.3, 0.45, 0.7, 0.55, 0.8 and 0.95 (cut), groups 1, 2, 3 and "bad".
+ * Pre-cut at qInv 0.3 rejects the pairs with the differences 0.5 and 0.4, the rest gives groups 1, 2 and "bad".
+ * Background, px {0.1, 0.2, 0.35, 0.6} x {0.02, 0.42}: sums 0.12, 0.52, 0.22, 0.62, 0.37, 0.77, 0.62 and 1.02 (cut), groups 0, 1, 2, 3 and "bad".
+ * Pre-cut rejects the differences 0.32, 0.33 and 0.58, the rest gives groups 0, 2, 3 and "bad".
+ * The second event has a single pair (sum 0.44) in group 1, rejected by the pre-cut (difference 0.4).
+ */
+void Run(Mixer &mixer)
+{
+    (void)mixer.AddEvent(std::make_shared<TestEvent>(TestEvent{1,0}),MakeTracks(1,{0.1f,0.2f,0.35f,0.6f}));
+    (void)mixer.AddEvent(std::make_shared<TestEvent>(TestEvent{2,0}),MakeTracks(2,{0.02f,0.42f}));
+    (void)mixer.GetSimilarPairs(std::make_shared<TestEvent>(TestEvent{3,0}));
+}
+
+void CheckCounters(bool preCut)
+{
+    Mixer mixer;
+    Configure(mixer,preCut);
+    mixer.EnableCounters(true);
+    TEST_CHECK(mixer.GetCountersState());
+
+    (void)mixer.AddEvent(std::make_shared<TestEvent>(TestEvent{1,0}),MakeTracks(1,{0.1f,0.2f,0.35f,0.6f}));
+    const Mixing::JJMixerCounters afterSignal = mixer.GetCounters();
+    TEST_CHECK(afterSignal.signalCalls == 1 && afterSignal.backgroundCalls == 0);
+    TEST_CHECK(afterSignal.pairsBuilt == (preCut ? 4u : 6u));
+    TEST_CHECK(afterSignal.pairsCut == 1);
+    TEST_CHECK(afterSignal.pairsPreCut == (preCut ? 2u : 0u));
+    TEST_CHECK(afterSignal.groupsCreated == (preCut ? 3u : 4u));
+    TEST_CHECK(afterSignal.bytesAllocated > 0);
+
+    mixer.ResetCounters();
+    (void)mixer.AddEvent(std::make_shared<TestEvent>(TestEvent{2,0}),MakeTracks(2,{0.02f,0.42f}));
+    (void)mixer.GetSimilarPairs(std::make_shared<TestEvent>(TestEvent{3,0}));
+    const Mixing::JJMixerCounters afterBackground = mixer.GetCounters();
+    TEST_CHECK(afterBackground.signalCalls == 1 && afterBackground.backgroundCalls == 1);
+    TEST_CHECK(afterBackground.pairsBuilt == (preCut ? 0u + 5u : 1u + 8u));
+    TEST_CHECK(afterBackground.pairsCut == 1);
+    TEST_CHECK(afterBackground.pairsPreCut == (preCut ? 1u + 3u : 0u));
+    TEST_CHECK(afterBackground.groupsCreated == (preCut ? 0u + 4u : 1u + 5u));
+
+    // the pairs by value count the same
+    mixer.ResetCounters();
+    (void)mixer.GetSimilarPairsByValue(std::make_shared<TestEvent>(TestEvent{3,0}));
+    const Mixing::JJMixerCounters byValue = mixer.GetCounters();
+    TEST_CHECK(byValue.backgroundCalls == 1 && byValue.pairsBuilt == (preCut ? 5u : 8u) && byValue.pairsCut == 1);
+    TEST_CHECK(byValue.pairsPreCut == (preCut ? 3u : 0u) && byValue.groupsCreated == (preCut ? 4u : 5u));
+}
+
+// with the instrumentation off nothing is counted, also after it was switched off again
+void CheckDisabled()
+{
+    for (bool preCut : {false,true})
+    {
+        Mixer mixer;
+        Configure(mixer,preCut);
+        TEST_CHECK(! mixer.GetCountersState());
+        Run(mixer);
+        (void)mixer.GetSimilarPairsByValue(std::make_shared<TestEvent>(TestEvent{3,0}));
+        mixer.ForEachBackgroundPair(std::make_shared<TestEvent>(TestEvent{3,0}),[](const int &, const TestPair &){});
+
+        auto isZero = [](const Mixing::JJMixerCounters &counters)
+        {
+            return counters.signalCalls == 0 && counters.backgroundCalls == 0 && counters.pairsBuilt == 0 && counters.pairsCut == 0 && counters.pairsPreCut == 0
+                && counters.groupsCreated == 0 && counters.bytesAllocated == 0 && counters.storeNanoseconds == 0 && counters.buildNanoseconds == 0 && counters.sortNanoseconds == 0;
+        };
+        TEST_CHECK(isZero(mixer.GetCounters()));
+
+        mixer.EnableCounters(true);
+        Run(mixer);
+        TEST_CHECK(! isZero(mixer.GetCounters()));
+        mixer.ResetCounters();
+        mixer.EnableCounters(false);
+        Run(mixer);
+        TEST_CHECK(isZero(mixer.GetCounters()));
+    }
+}
+
+int main()
+{
+    CheckCounters(false);
+    CheckCounters(true);
+    CheckDisabled();
+
+    return Test::Report("testMixerCounters");
+}
@@ -0,0 +1,140 @@
+/**
+ * @file testPairArena.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Checks of the grouping (counting sort) of Mixing::JJPairArena and of the arena-based methods of JJFemtoMixer
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJFemtoMixer.hxx"
+
+#include "TestObjects.hxx"
+
+#include <random>
+#include <map>
+
+struct ValuePair
+{
+    int index;
+};
+
+// groups have to come in the order of the first appearance of their key and hold exactly the pairs with that key, in the order of construction
+void CheckGroups(const Mixing::JJPairArena<ValuePair,int> &arena, const std::vector<int> &keys)
+{
+    std::vector<int> keyOrder;
+    std::map<int,std::vector<int> > expected;
+    for (std::size_t index = 0; index < keys.size(); ++index)
+    {
+        if (expected.count(keys[index]) == 0)
+            keyOrder.push_back(keys[index]);
+        expected[keys[index]].push_back(static_cast<int>(index));
+    }
+
+    TEST_CHECK(arena.size() == keys.size());
+    TEST_CHECK(arena.GetNGroups() == expected.size());
+
+    std::size_t group = 0;
+    for (const auto &[key,pairs] : arena)
+    {
+        TEST_CHECK(group < keyOrder.size() && key == keyOrder[group]);
+        ++group;
+
+        std::vector<int> indices;
+        for (const ValuePair &pair : pairs)
+            indices.push_back(pair.index);
+        TEST_CHECK(indices == expected[key]);
+
+        const auto byKey = arena.GetGroup(key);
+        TEST_CHECK(byKey.size() == pairs.size() && (byKey.empty() || &byKey[0] == &pairs[0]));
+    }
+    TEST_CHECK(group == keyOrder.size());
+}
+
+void FillArena(Mixing::JJPairArena<ValuePair,int> &arena, const std::vector<int> &keys)
+{
+    arena.Reset();
+    for (std::size_t index = 0; index < keys.size(); ++index)
+    {
+        arena.Emplace(ValuePair{static_cast<int>(index)});
+        arena.AssignLast(keys[index]);
+    }
+    arena.BuildGroups();
+}
+
+int main()
+{
+    Mixing::JJPairArena<ValuePair,int> arena;
+
+    // no pairs at all
+    FillArena(arena,{});
+    TEST_CHECK(arena.size() == 0 && arena.GetNGroups() == 0 && arena.begin() == arena.end());
+    TEST_CHECK(arena.GetGroup(1).empty());
+
+    // a single group and interleaved groups
+    for (const std::vector<int> &keys : {std::vector<int>{7,7,7},std::vector<int>{3,1,3,2,1,1,3},std::vector<int>{5}})
+    {
+        FillArena(arena,keys);
+        CheckGroups(arena,keys);
+        TEST_CHECK(arena.GetGroup(-1).empty());
+    }
+
+    // random keys, the arena is reset and reused without growing once it is large enough
+    std::mt19937 generator(7);
+    std::size_t allocated = 0;
+    for (int round = 0; round < 50; ++round)
+    {
+        std::uniform_int_distribution<int> keyDist(0,1 + round % 10);
+        std::vector<int> keys(500);
+        for (int &key : keys)
+            key = keyDist(generator);
+
+        FillArena(arena,keys);
+        CheckGroups(arena,keys);
+
+        if (round == 10)
+            allocated = arena.GetAllocatedBytes();
+        if (round > 10)
+            TEST_CHECK(arena.GetAllocatedBytes() == allocated);
+    }
+
+    // the arena-based methods of the mixer give the same groups as the pointer-based ones
+    {
+        Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,int,int> mixer;
+        mixer.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &event){return event->eventClass;});
+        mixer.SetPairHashingFunction([](const std::shared_ptr<TestPair> &pair){return static_cast<int>(10.f * (pair->trck1->px + pair->trck2->px));});
+        mixer.SetPairCuttingFunction([](const std::shared_ptr<TestPair> &pair){return pair->trck1->px < 0.1f;});
+        mixer.SetSeed(3);
+
+        Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,int,int> byValue;
+        byValue.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &event){return event->eventClass;});
+        byValue.SetPairHashingFunction([](const std::shared_ptr<TestPair> &pair){return static_cast<int>(10.f * (pair->trck1->px + pair->trck2->px));});
+        byValue.SetPairCuttingFunction([](const std::shared_ptr<TestPair> &pair){return pair->trck1->px < 0.1f;});
+        byValue.SetSeed(3);
+
+        // compares the groups by the values of the pairs, the pair cut puts the rejected pairs into the "bad" group of both
+        auto same = [](const auto &pointerPairs, const auto &valuePairs)
+        {
+            std::map<int,std::vector<std::pair<float,float> > > fromPointers, fromValues;
+            for (const auto &[key,pairs] : pointerPairs)
+                for (const auto &pair : pairs)
+                    fromPointers[key].emplace_back(pair->trck1->px,pair->trck2->px);
+            for (const auto &[key,pairs] : valuePairs)
+                for (const auto &pair : pairs)
+                    fromValues[key].emplace_back(pair.trck1->px,pair.trck2->px);
+            return fromPointers == fromValues;
+        };
+
+        for (long evt = 0; evt < 40; ++evt)
+        {
+            const auto event = std::make_shared<TestEvent>(TestEvent{evt,static_cast<int>(evt % 3)});
+            const auto tracks = Test::MakeTracks(*event,12);
+            TEST_CHECK(same(mixer.AddEvent(event,tracks),byValue.AddEventByValue(event,tracks)));
+            TEST_CHECK(same(mixer.GetSimilarPairs(event),byValue.GetSimilarPairsByValue(event)));
+        }
+    }
+
+    return Test::Report("testPairArena");
+}
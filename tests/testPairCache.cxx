@@ -0,0 +1,112 @@
+/**
+ * @file testPairCache.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Checks that the background pair cache of JJFemtoMixer gives the same pairs as building them on each call
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJFemtoMixer.hxx"
+
+#include "TestObjects.hxx"
+
+#include <algorithm>
+
+using Mixer = Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,int,int>;
+
+void Configure(Mixer &mixer, std::size_t bufferSize, std::size_t tracksPerEvent, bool preCut)
+{
+    mixer.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &event){return event->eventClass;});
+    mixer.SetPairHashingFunction([](const std::shared_ptr<TestPair> &pair){return static_cast<int>(4.f * (pair->trck1->px + pair->trck2->px));});
+    mixer.SetPairCuttingFunction([](const std::shared_ptr<TestPair> &pair){return pair->trck1->py > 0.9f;});
+    mixer.SetMaxBufferSize(bufferSize);
+    mixer.SetTracksPerEvent(tracksPerEvent);
+    mixer.SetSeed(21);
+    if (preCut)
+    {
+        Mixing::JJPairPreCut cut;
+        cut.maxQinv = 0.6f;
+        mixer.SetPairPreCut(cut);
+    }
+}
+
+// the cache collects the pairs entry by entry, so only the order of the pairs within a group may differ, the pairs themselves (including the order of their tracks) may not
+std::map<int,Test::PairList> SortGroups(std::map<int,Test::PairList> flat)
+{
+    for (auto &[key,pairs] : flat)
+        std::sort(pairs.begin(),pairs.end());
+
+    return flat;
+}
+
+// pairs passed to a visitor, grouped by key
+std::map<int,Test::PairList> VisitBackground(const Mixer &mixer, const std::shared_ptr<TestEvent> &event)
+{
+    std::map<int,Test::PairList> flat;
+    mixer.ForEachBackgroundPair(event,[&flat](const int &key, const TestPair &pair){flat[key].emplace_back(pair.trck1->eventId,pair.trck1->px,pair.trck2->eventId,pair.trck2->px);});
+    return SortGroups(flat);
+}
+
+// the cached mixer has to return the same pairs, with the same order of the tracks in each pair, as the one without the cache
+void CheckSameAsUncached(std::size_t bufferSize, std::size_t tracksPerEvent, bool preCut, bool fixBuffer)
+{
+    Mixer uncached, cached;
+    Configure(uncached,bufferSize,tracksPerEvent,preCut);
+    Configure(cached,bufferSize,tracksPerEvent,preCut);
+    uncached.FixBuffer(fixBuffer);
+    cached.FixBuffer(fixBuffer);
+    cached.SetBackgroundPairCaching(true);
+
+    bool same = true, sameVisited = true;
+    std::size_t nBackground = 0;
+    for (long evt = 0; evt < 80; ++evt)
+    {
+        // the multiplicity varies, including events with fewer tracks than are buffered and events without tracks
+        const auto event = std::make_shared<TestEvent>(TestEvent{evt,static_cast<int>(evt % 3)});
+        const auto tracks = Test::MakeTracks(*event,(evt % 11 == 5) ? 0 : evt % 5);
+
+        (void)uncached.AddEvent(event,tracks);
+        (void)cached.AddEvent(event,tracks);
+
+        // the background of an event which is not in the buffer includes the newest entry too
+        const auto other = std::make_shared<TestEvent>(TestEvent{-1,static_cast<int>(evt % 3)});
+        for (const auto &query : {event,other})
+        {
+            const auto expected = SortGroups(Test::Flatten(uncached.GetSimilarPairs(query)));
+            same &= (SortGroups(Test::Flatten(cached.GetSimilarPairs(query))) == expected);
+            sameVisited &= (VisitBackground(cached,query) == VisitBackground(uncached,query));
+            for (const auto &[key,pairs] : expected)
+                nBackground += pairs.size();
+        }
+
+        // changing the settings in the middle rebuilds the cache
+        if (evt == 40)
+        {
+            uncached.SetMaxBufferSize(bufferSize / 2 + 1);
+            cached.SetMaxBufferSize(bufferSize / 2 + 1);
+        }
+        if (evt == 60)
+        {
+            cached.SetBackgroundPairCaching(false);
+            cached.SetBackgroundPairCaching(true);
+        }
+    }
+
+    TEST_CHECK(nBackground > 0);
+    TEST_CHECK(same);
+    TEST_CHECK(sameVisited);
+}
+
+int main()
+{
+    for (std::size_t bufferSize : {2,3,6})
+        for (std::size_t tracksPerEvent : {1,3})
+            for (bool preCut : {false,true})
+                for (bool fixBuffer : {false,true})
+                    CheckSameAsUncached(bufferSize,tracksPerEvent,preCut,fixBuffer);
+
+    return Test::Report("testPairCache");
+}
@@ -0,0 +1,105 @@
+/**
+ * @file testPairVisitor.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Checks that the pair visitors of JJFemtoMixer pass the same pairs, with the same groups, as AddEvent and GetSimilarPairs return
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJFemtoMixer.hxx"
+
+#include "TestObjects.hxx"
+
+template<typename Key>
+Key MakeKey(int value)
+{
+    if constexpr (std::is_same<Key,std::string>::value)
+        return std::to_string(value);
+    else
+        return value;
+}
+
+template<typename Mixer, typename EventKey, typename PairKey>
+void Configure(Mixer &mixer, std::size_t tracksPerEvent, bool preCut, bool cache)
+{
+    mixer.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &event){return MakeKey<EventKey>(event->eventClass);});
+    mixer.SetPairHashingFunction([](const std::shared_ptr<TestPair> &pair){return MakeKey<PairKey>(static_cast<int>(4.f * (pair->trck1->px + pair->trck2->px)));});
+    mixer.SetPairCuttingFunction([](const std::shared_ptr<TestPair> &pair){return pair->trck1->py > 0.9f;});
+    mixer.SetMaxBufferSize(4);
+    mixer.SetTracksPerEvent(tracksPerEvent);
+    mixer.SetSeed(3);
+    if (preCut)
+    {
+        Mixing::JJPairPreCut cut;
+        cut.maxQinv = 0.6f;
+        mixer.SetPairPreCut(cut);
+    }
+    mixer.SetBackgroundPairCaching(cache);
+}
+
+/**
+ * @brief Feed the same events to two equally configured mixers, one returning the groups and one calling the visitors.
+ * The (group key, pair) stream of a visitor, grouped by key in the order of the calls, has to be exactly the returned groups: the same keys, pairs, orientation of the pairs and order within each group.
+ *
+ */
+template<typename EventKey, typename PairKey>
+void CheckSameAsGroups(std::size_t tracksPerEvent, bool preCut, bool cache)
+{
+    using Mixer = Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,EventKey,PairKey>;
+    Mixer returning, visiting;
+    Configure<Mixer,EventKey,PairKey>(returning,tracksPerEvent,preCut,cache);
+    Configure<Mixer,EventKey,PairKey>(visiting,tracksPerEvent,preCut,cache);
+
+    std::map<PairKey,Test::PairList> visited;
+    auto visitor = [&visited](const PairKey &key, const TestPair &pair){visited[key].emplace_back(pair.trck1->eventId,pair.trck1->px,pair.trck2->eventId,pair.trck2->px);};
+
+    bool sameSignal = true, sameBackground = true;
+    std::size_t nSignal = 0, nBackground = 0, nCut = 0;
+    for (long evt = 0; evt < 50; ++evt)
+    {
+        const auto event = std::make_shared<TestEvent>(TestEvent{evt,static_cast<int>(evt % 3)});
+        const auto tracks = Test::MakeTracks(*event,(evt % 9 == 2) ? 0 : 1 + evt % 7);
+
+        const auto signal = Test::Flatten(returning.AddEvent(event,tracks));
+        visited.clear();
+        visiting.ForEachSignalPair(event,tracks,visitor);
+        sameSignal &= (visited == signal);
+        for (const auto &[key,pairs] : signal)
+            nSignal += pairs.size();
+
+        const auto other = std::make_shared<TestEvent>(TestEvent{-1,static_cast<int>(evt % 3)});
+        for (const auto &query : {event,other})
+        {
+            const auto background = Test::Flatten(returning.GetSimilarPairs(query));
+            visited.clear();
+            visiting.ForEachBackgroundPair(query,visitor);
+            sameBackground &= (visited == background);
+            for (const auto &[key,pairs] : background)
+            {
+                nBackground += pairs.size();
+                if (key == Mixing::KeyTraits<PairKey>::Bad())
+                    nCut += pairs.size();
+            }
+        }
+    }
+
+    TEST_CHECK(nSignal > 0 && nBackground > 0 && nCut > 0);
+    TEST_CHECK(sameSignal);
+    TEST_CHECK(sameBackground);
+}
+
+int main()
+{
+    for (std::size_t tracksPerEvent : {1,3})
+        for (bool preCut : {false,true})
+            for (bool cache : {false,true})
+            {
+                CheckSameAsGroups<int,int>(tracksPerEvent,preCut,cache);
+                CheckSameAsGroups<std::string,std::string>(tracksPerEvent,preCut,cache);
+            }
+
+    return Test::Report("testPairVisitor");
+}
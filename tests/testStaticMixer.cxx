@@ -0,0 +1,142 @@
+/**
+ * @file testStaticMixer.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Checks that JJFemtoMixerStatic gives the same pairs as JJFemtoMixer with the same hashing and cut functions
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJFemtoMixerStatic.hxx"
+
+#include "TestObjects.hxx"
+
+#include <algorithm>
+
+struct ClassHashing
+{
+    int operator()(const TestEvent &event) const noexcept {return event.eventClass;}
+};
+
+struct PxHashing
+{
+    std::uint32_t operator()(const TestPair &pair) const noexcept {return static_cast<std::uint32_t>(4.f * (pair.trck1->px + pair.trck2->px));}
+};
+
+struct PyCut
+{
+    bool operator()(const TestPair &pair) const noexcept {return pair.trck1->py > 0.9f;}
+};
+
+using Runtime = Mixing::JJFemtoMixer<TestEvent,TestTrack,TestPair,int,std::uint32_t>;
+
+// the cache does not keep the order of the pairs within a group, so the groups are compared sorted when it is used
+std::map<std::uint32_t,Test::PairList> SortGroups(std::map<std::uint32_t,Test::PairList> flat)
+{
+    for (auto &[key,pairs] : flat)
+        std::sort(pairs.begin(),pairs.end());
+
+    return flat;
+}
+
+/**
+ * @brief Feed the same events to a static mixer and to a runtime one with the same functions and compare the signal and background groups
+ *
+ * @tparam Static JJFemtoMixerStatic type
+ * @param staticMixer mixer under test
+ * @param runtime JJFemtoMixer configured with the same functions
+ * @param cache whether the background pair cache is used
+ * @param preCut whether the pair pre-cut is used
+ */
+template<typename Static>
+void CheckSameAsRuntime(Static staticMixer, Runtime runtime, bool cache, bool preCut)
+{
+    auto configure = [cache,preCut](auto &mixer)
+    {
+        mixer.SetMaxBufferSize(4);
+        mixer.SetTracksPerEvent(2);
+        mixer.SetSeed(9);
+        mixer.SetBackgroundPairCaching(cache);
+        if (preCut)
+        {
+            Mixing::JJPairPreCut cut;
+            cut.maxQinv = 0.6f;
+            mixer.SetPairPreCut(cut);
+        }
+    };
+    configure(staticMixer);
+    configure(runtime);
+    TEST_CHECK(staticMixer.GetBackgroundPairCaching() == cache && staticMixer.GetMaxBufferSize() == 4 && staticMixer.GetTracksPerEvent() == 2);
+
+    bool sameSignal = true, sameBackground = true;
+    std::size_t nSignal = 0, nBackground = 0;
+    for (long evt = 0; evt < 60; ++evt)
+    {
+        const auto event = std::make_shared<TestEvent>(TestEvent{evt,static_cast<int>(evt % 3)});
+        const auto tracks = Test::MakeTracks(*event,(evt % 13 == 4) ? 0 : 1 + evt % 6);
+
+        const auto signal = Test::Flatten(runtime.AddEvent(event,tracks));
+        sameSignal &= (Test::Flatten(staticMixer.AddEvent(event,tracks)) == signal);
+        for (const auto &[key,pairs] : signal)
+            nSignal += pairs.size();
+
+        const auto other = std::make_shared<TestEvent>(TestEvent{-1,static_cast<int>(evt % 3)});
+        for (const auto &query : {event,other})
+        {
+            const auto background = Test::Flatten(runtime.GetSimilarPairs(query));
+            if (cache)
+                sameBackground &= (SortGroups(Test::Flatten(staticMixer.GetSimilarPairs(query))) == SortGroups(background));
+            else
+                sameBackground &= (Test::Flatten(staticMixer.GetSimilarPairs(query)) == background);
+            for (const auto &[key,pairs] : background)
+                nBackground += pairs.size();
+        }
+    }
+
+    TEST_CHECK(nSignal > 0 && nBackground > 0);
+    TEST_CHECK(sameSignal);
+    TEST_CHECK(sameBackground);
+    TEST_CHECK(staticMixer.GetMemoryUsage() == runtime.GetMemoryUsage());
+}
+
+// runtime mixer with the functions of the policies, the ones left out stay undefined like the No* policies
+Runtime MakeRuntime(bool hashing, bool cut)
+{
+    Runtime runtime;
+    runtime.SetEventHashingFunction([](const std::shared_ptr<TestEvent> &event){return ClassHashing()(*event);});
+    if (hashing)
+        runtime.SetPairHashingFunction([](const std::shared_ptr<TestPair> &pair){return PxHashing()(*pair);});
+    if (cut)
+        runtime.SetPairCuttingFunction([](const std::shared_ptr<TestPair> &pair){return PyCut()(*pair);});
+    return runtime;
+}
+
+int main()
+{
+    for (bool cache : {false,true})
+        for (bool preCut : {false,true})
+        {
+            CheckSameAsRuntime(Mixing::MakeStaticMixer<TestEvent,TestTrack,TestPair>(ClassHashing(),PxHashing(),PyCut()),MakeRuntime(true,true),cache,preCut);
+            CheckSameAsRuntime(Mixing::MakeStaticMixer<TestEvent,TestTrack,TestPair>(ClassHashing(),Mixing::NoPairHashing(),PyCut()),MakeRuntime(false,true),cache,preCut);
+            CheckSameAsRuntime(Mixing::MakeStaticMixer<TestEvent,TestTrack,TestPair>(ClassHashing(),PxHashing()),MakeRuntime(true,false),cache,preCut);
+            CheckSameAsRuntime(Mixing::MakeStaticMixer<TestEvent,TestTrack,TestPair>(ClassHashing()),MakeRuntime(false,false),cache,preCut);
+        }
+
+    // lambdas as policies, the pair group of a single pair and the event hash
+    auto lambdaMixer = Mixing::MakeStaticMixer<TestEvent,TestTrack,TestPair>([](const TestEvent &event){return event.eventClass;},
+                                                                             [](const TestPair &pair){return static_cast<std::uint32_t>(4.f * (pair.trck1->px + pair.trck2->px));},
+                                                                             [](const TestPair &pair){return pair.trck1->py > 0.9f;});
+    CheckSameAsRuntime(lambdaMixer,MakeRuntime(true,true),false,false);
+
+    const TestEvent event{1,2};
+    const auto tracks = Test::MakeTracks(event,2);
+    const TestPair pair(tracks[0],tracks[1]);
+    TEST_CHECK(lambdaMixer.GetEventHash(std::make_shared<TestEvent>(event)) == 2);
+    TEST_CHECK(lambdaMixer.GetPairGroup(pair) == (PyCut()(pair) ? Mixing::KeyTraits<std::uint32_t>::Bad() : PxHashing()(pair)));
+    const auto noGrouping = Mixing::MakeStaticMixer<TestEvent,TestTrack,TestPair>(ClassHashing());
+    TEST_CHECK(noGrouping.GetPairGroup(pair) == Mixing::KeyTraits<std::uint32_t>::Default());
+
+    return Test::Report("testStaticMixer");
+}
@@ -0,0 +1,246 @@
+/**
+ * @file testTrackSoA.cxx
+ * @author Jędrzej Kołaś (jedrzej.kolas.dokt@pw.edu.pl)
+ * @brief Checks of the branchless pair pre-cut of Mixing::JJTrackSoA against a scalar double-precision calculation
+ * @version 1.0
+ * @date 2024-12-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "../JJTrackSoA.hxx"
+
+#include "TestObjects.hxx"
+
+#include <random>
+#include <algorithm>
+#include <cstring>
+
+using Mixing::JJPairPreCut;
+using Mixing::JJTrackSoA;
+
+std::shared_ptr<TestTrack> MakeTrack(float px, float py, float pz, float e)
+{
+    return std::make_shared<TestTrack>(TestTrack{px,py,pz,e,0,0});
+}
+
+/**
+ * @brief Pair variables computed straight from their definitions, in double precision
+ *
+ */
+struct PairVariables
+{
+    double qInv, kT, openingAngle;
+
+    PairVariables(const TestTrack &first, const TestTrack &second)
+    {
+        const double dpx = double(first.px) - second.px, dpy = double(first.py) - second.py, dpz = double(first.pz) - second.pz, de = double(first.e) - second.e;
+        // a negative qInv^2 (off-shell tracks) counts as qInv = 0
+        qInv = std::sqrt(std::max(dpx * dpx + dpy * dpy + dpz * dpz - de * de,0.));
+        kT = 0.5 * std::hypot(double(first.px) + second.px,double(first.py) + second.py);
+
+        const double p1 = std::sqrt(double(first.px) * first.px + double(first.py) * first.py + double(first.pz) * first.pz);
+        const double p2 = std::sqrt(double(second.px) * second.px + double(second.py) * second.py + double(second.pz) * second.pz);
+        const double dot = double(first.px) * second.px + double(first.py) * second.py + double(first.pz) * second.pz;
+        // the angle of a track without momentum is not defined, such pairs are never rejected by the angle
+        openingAngle = (p1 > 0. && p2 > 0.) ? std::acos(std::clamp(dot / (p1 * p2),-1.,1.)) : 4.;
+    }
+
+    [[nodiscard]] bool Passes(const JJPairPreCut &cut) const
+    {
+        return qInv >= cut.minQinv && qInv <= cut.maxQinv && kT >= cut.minKt && kT <= cut.maxKt && openingAngle >= cut.minOpeningAngle;
+    }
+    // a value this close to a limit may land on either side of it in single precision
+    [[nodiscard]] bool IsAmbiguous(const JJPairPreCut &cut) const
+    {
+        auto near = [](double value, float limit){return std::isfinite(limit) && std::abs(value - limit) <= 1e-4 * (1. + std::abs(value));};
+        return near(qInv,cut.minQinv) || near(qInv,cut.maxQinv) || near(kT,cut.minKt) || near(kT,cut.maxKt) || near(openingAngle,cut.minOpeningAngle);
+    }
+};
+
+/**
+ * @brief Run the kernel for the pairs (first, j) with j in [begin, end), in blocks of at most blockLength pairs
+ *
+ * @return std::vector<std::uint8_t> accepted flag of each pair
+ */
+std::vector<std::uint8_t> RunKernel(const JJTrackSoA &soa, std::size_t first, std::size_t begin, std::size_t end, const JJPairPreCut &cut, std::size_t blockLength = JJTrackSoA::BlockSize)
+{
+    std::vector<std::uint8_t> result;
+    for (std::size_t blockBegin = begin; blockBegin < end; blockBegin += blockLength)
+    {
+        const std::size_t blockEnd = std::min(blockBegin + blockLength,end);
+        std::uint8_t accepted[JJTrackSoA::BlockSize];
+        std::memset(accepted,0xAA,sizeof(accepted));
+        soa.PreCutBlock(first,blockBegin,blockEnd,cut,accepted);
+
+        // the kernel writes only the flags of the block
+        for (std::size_t iter = blockEnd - blockBegin; iter < JJTrackSoA::BlockSize; ++iter)
+            TEST_CHECK(accepted[iter] == 0xAA);
+        result.insert(result.end(),accepted,accepted + (blockEnd - blockBegin));
+    }
+
+    return result;
+}
+
+// result of the kernel for a single pair of tracks
+bool Accepts(const std::shared_ptr<TestTrack> &first, const std::shared_ptr<TestTrack> &second, const JJPairPreCut &cut)
+{
+    JJTrackSoA soa;
+    soa.Assign(std::vector<std::shared_ptr<TestTrack> >{first,second});
+    return RunKernel(soa,0,1,2,cut).front() == 1;
+}
+
+// the default values disable each cut, also for pairs with a negative qInv^2, tracks without momentum and very large momenta
+void CheckDefaults()
+{
+    const std::vector<std::shared_ptr<TestTrack> > tracks = {MakeTrack(0.f,0.f,0.f,0.f),MakeTrack(0.f,0.f,0.f,5.f),MakeTrack(0.1f,0.f,0.f,0.1f),MakeTrack(-0.1f,0.f,0.f,3.f),
+                                                             MakeTrack(1e15f,-1e15f,1e15f,2e15f),MakeTrack(0.3f,0.4f,-0.2f,1.f),MakeTrack(-0.3f,-0.4f,0.2f,1.f)};
+    JJTrackSoA soa;
+    soa.Assign(tracks);
+
+    const JJPairPreCut defaults;
+    JJPairPreCut qInvOnly, ktOnly, angleOnly;
+    qInvOnly.minQinv = 0.f;
+    qInvOnly.maxQinv = 1e30f;
+    ktOnly.minKt = 0.f;
+    ktOnly.maxKt = 1e30f;
+    angleOnly.minOpeningAngle = 0.f;
+
+    bool allAccepted = true;
+    for (std::size_t first = 0; first + 1 < tracks.size(); ++first)
+        for (const auto &cut : {defaults,qInvOnly,ktOnly,angleOnly})
+            for (const auto flag : RunKernel(soa,first,first + 1,tracks.size(),cut))
+                allAccepted &= (flag == 1);
+    TEST_CHECK(allAccepted);
+
+    // each limit left at its default does not affect the others
+    JJPairPreCut onlyMaxQinv;
+    onlyMaxQinv.maxQinv = 0.5f;
+    TEST_CHECK(Accepts(tracks[0],tracks[1],onlyMaxQinv)); // qInv^2 < 0
+    TEST_CHECK(! Accepts(tracks[5],tracks[6],onlyMaxQinv)); // qInv ~ 1.08
+    JJPairPreCut onlyMinQinv;
+    onlyMinQinv.minQinv = 0.5f;
+    TEST_CHECK(! Accepts(tracks[0],tracks[1],onlyMinQinv));
+    TEST_CHECK(Accepts(tracks[5],tracks[6],onlyMinQinv));
+}
+
+// a pair exactly on a limit passes, the nearest float value on the other side of it does not
+void CheckBoundaries()
+{
+    auto below = [](float value){return std::nextafter(value,0.f);};
+    auto above = [](float value){return std::nextafter(value,4.f);};
+
+    // qInv = 1: dp = (1, 0, 0), de = 0
+    const auto qFirst = MakeTrack(0.5f,0.f,0.f,1.f), qSecond = MakeTrack(-0.5f,0.f,0.f,1.f);
+    JJPairPreCut cut;
+    cut.minQinv = 1.f;
+    TEST_CHECK(Accepts(qFirst,qSecond,cut));
+    cut.minQinv = above(1.f);
+    TEST_CHECK(! Accepts(qFirst,qSecond,cut));
+    cut = JJPairPreCut();
+    cut.maxQinv = 1.f;
+    TEST_CHECK(Accepts(qFirst,qSecond,cut));
+    cut.maxQinv = below(1.f);
+    TEST_CHECK(! Accepts(qFirst,qSecond,cut));
+
+    // kT = 0.5: the transverse momenta add up to (1, 0)
+    const auto ktFirst = MakeTrack(0.75f,0.f,0.25f,1.f), ktSecond = MakeTrack(0.25f,0.f,-0.5f,1.f);
+    cut = JJPairPreCut();
+    cut.minKt = 0.5f;
+    TEST_CHECK(Accepts(ktFirst,ktSecond,cut));
+    cut.minKt = above(0.5f);
+    TEST_CHECK(! Accepts(ktFirst,ktSecond,cut));
+    cut = JJPairPreCut();
+    cut.maxKt = 0.5f;
+    TEST_CHECK(Accepts(ktFirst,ktSecond,cut));
+    cut.maxKt = below(0.5f);
+    TEST_CHECK(! Accepts(ktFirst,ktSecond,cut));
+
+    // the opening angle of perpendicular tracks is pi/2, which is not a float: the nearest values below and above it are the limits closest to the boundary
+    const auto angleFirst = MakeTrack(1.f,0.f,0.f,2.f), angleSecond = MakeTrack(0.f,0.f,3.f,4.f);
+    const double halfPi = std::acos(0.);
+    const float halfPiAbove = (static_cast<float>(halfPi) > halfPi) ? static_cast<float>(halfPi) : above(static_cast<float>(halfPi));
+    cut = JJPairPreCut();
+    cut.minOpeningAngle = below(halfPiAbove);
+    TEST_CHECK(Accepts(angleFirst,angleSecond,cut) && PairVariables(*angleFirst,*angleSecond).Passes(cut));
+    cut.minOpeningAngle = halfPiAbove;
+    TEST_CHECK(! Accepts(angleFirst,angleSecond,cut) && ! PairVariables(*angleFirst,*angleSecond).Passes(cut));
+
+    // back-to-back tracks have the largest opening angle, pi
+    const auto backToBack = MakeTrack(-2.f,0.f,0.f,3.f);
+    cut.minOpeningAngle = 3.f;
+    TEST_CHECK(Accepts(angleFirst,backToBack,cut));
+}
+
+// random tracks: the kernel has to agree with the scalar calculation for every pair which is not within the rounding of a limit, for any block length
+void CheckAgainstReference()
+{
+    std::mt19937 generator(17);
+    std::uniform_real_distribution<float> momentumDist(-1.f,1.f), massDist(0.1f,1.f);
+
+    // not a multiple of BlockSize, so the pairs of the first tracks need two blocks with a partial second one
+    const std::size_t nTracks = JJTrackSoA::BlockSize + 45;
+    std::vector<std::shared_ptr<TestTrack> > tracks;
+    for (std::size_t track = 0; track < nTracks; ++track)
+    {
+        const float px = momentumDist(generator), py = momentumDist(generator), pz = momentumDist(generator), mass = massDist(generator);
+        tracks.push_back(MakeTrack(px,py,pz,std::sqrt(px * px + py * py + pz * pz + mass * mass)));
+    }
+    JJTrackSoA soa;
+    soa.Assign(tracks);
+
+    JJPairPreCut cut;
+    cut.minQinv = 0.3f;
+    cut.maxQinv = 1.2f;
+    cut.minKt = 0.15f;
+    cut.maxKt = 0.7f;
+    cut.minOpeningAngle = 0.4f;
+
+    std::size_t nCompared = 0, nAccepted = 0, nAcceptedAll = 0;
+    bool same = true, sameForBlocks = true;
+    for (std::size_t first = 0; first + 1 < nTracks; ++first)
+    {
+        const auto flags = RunKernel(soa,first,first + 1,nTracks,cut);
+        for (std::size_t blockLength : {1,7,100})
+            sameForBlocks &= (RunKernel(soa,first,first + 1,nTracks,cut,blockLength) == flags);
+        for (const auto flag : flags)
+            nAcceptedAll += flag;
+
+        for (std::size_t second = first + 1; second < nTracks; ++second)
+        {
+            const PairVariables reference(*tracks[first],*tracks[second]);
+            if (reference.IsAmbiguous(cut))
+                continue;
+
+            ++nCompared;
+            nAccepted += flags[second - first - 1];
+            same &= ((flags[second - first - 1] == 1) == reference.Passes(cut));
+        }
+    }
+
+    TEST_CHECK(same);
+    TEST_CHECK(sameForBlocks);
+    // every limit has to reject some of the pairs and some have to pass, otherwise the comparison shows little
+    TEST_CHECK(nCompared > nTracks * (nTracks - 1) / 2 * 99 / 100 && nAccepted > nCompared / 20 && nAccepted < nCompared / 2);
+    for (auto disable : {+[](JJPairPreCut &tested){tested.minQinv = 0.f;},+[](JJPairPreCut &tested){tested.maxQinv = 1e30f;},+[](JJPairPreCut &tested){tested.minKt = 0.f;},
+                         +[](JJPairPreCut &tested){tested.maxKt = 1e30f;},+[](JJPairPreCut &tested){tested.minOpeningAngle = 0.f;}})
+    {
+        JJPairPreCut looser = cut;
+        disable(looser);
+        std::size_t nLooser = 0;
+        for (std::size_t first = 0; first + 1 < nTracks; ++first)
+            for (const auto flag : RunKernel(soa,first,first + 1,nTracks,looser))
+                nLooser += flag;
+        TEST_CHECK(nLooser > nAcceptedAll);
+    }
+}
+
+int main()
+{
+    CheckDefaults();
+    CheckBoundaries();
+    CheckAgainstReference();
+
+    return Test::Report("testTrackSoA");
+}